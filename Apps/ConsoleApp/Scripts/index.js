@@ -5,6 +5,40 @@ let engine = null;
 let scene = null;
 let outputTexture = null;
 let rootMesh = null;
+let currentLoad = null;
+let environmentHelper = null;
+
+const DEFAULT_ENVIRONMENT_URL = "https://assets.babylonjs.com/environments/environmentSpecular.env";
+
+// Vertex data for skinning is not captured since skeletons are not.
+const SNAPSHOT_SKIPPED_KINDS = [
+    BABYLON.VertexBuffer.MatricesIndicesKind,
+    BABYLON.VertexBuffer.MatricesWeightsKind,
+    BABYLON.VertexBuffer.MatricesIndicesExtraKind,
+    BABYLON.VertexBuffer.MatricesWeightsExtraKind,
+];
+
+// Texture properties restored from the serialized material along with the
+// captured pixels.
+const SNAPSHOT_TEXTURE_PROPERTIES = [
+    "level",
+    "coordinatesIndex",
+    "hasAlpha",
+    "getAlphaFromRGB",
+    "gammaSpace",
+    "uOffset",
+    "vOffset",
+    "uScale",
+    "vScale",
+    "uAng",
+    "vAng",
+    "wAng",
+    "uRotationCenter",
+    "vRotationCenter",
+    "wRotationCenter",
+    "wrapU",
+    "wrapV",
+];
 
 /**
  * Sets up the engine, scene, and output texture.
@@ -17,9 +51,6 @@ function startup(nativeTexture, width, height) {
     scene = new BABYLON.Scene(engine);
     scene.clearColor.set(1, 1, 1, 1);
 
-    // Create an environment so that reflections look good.
-    scene.createDefaultEnvironment({ createSkybox: false, createGround: false });
-
     // Wrap the input native texture in a render target texture for the output
     // render target of the camera used in `loadAndRenderAssetAsync` below.
     // Note that the properties (width, height, samples, etc.) must match the
@@ -40,19 +71,99 @@ function startup(nativeTexture, width, height) {
     );
 }
 
+/**
+ * Creates an environment so that reflections look good. `environmentData` is
+ * the prefiltered environment cache mapped by `App.cpp`; when there is none,
+ * the default environment is downloaded and saved to the cache.
+ */
+async function loadEnvironmentAsync(environmentData) {
+    if (!environmentData) {
+        environmentData = await BABYLON.Tools.LoadFileAsync(DEFAULT_ENVIRONMENT_URL, true);
+        try {
+            saveEnvironment(environmentData);
+        } catch (error) {
+            console.log(`Failed to save the environment cache: ${error.message}`);
+        }
+    }
+
+    // Replace the environment of an earlier attempt, e.g. from a cache that
+    // failed to load.
+    if (environmentHelper) {
+        environmentHelper.dispose();
+        environmentHelper = null;
+    }
+
+    // Reject on corrupt data instead of waiting forever for the texture.
+    const environmentTexture = await new Promise((resolve, reject) => {
+        const texture = new BABYLON.CubeTexture("environment.env", scene, {
+            buffer: new Uint8Array(environmentData),
+            forcedExtension: ".env",
+            onError: (message, exception) => reject(exception || new Error(message || "Failed to load the environment")),
+        });
+        whenTextureReadyAsync(texture).then(() => resolve(texture));
+    });
+    environmentHelper = scene.createDefaultEnvironment({ createSkybox: false, createGround: false, environmentTexture: environmentTexture });
+}
+
+/**
+ * Waits until a texture has loaded.
+ */
+function whenTextureReadyAsync(texture) {
+    return new Promise((resolve) => BABYLON.Texture.WhenAllReady([texture], resolve));
+}
+
 /**
  * Loads and renders an asset given its URL.
  */
 async function loadAndRenderAssetAsync(url) {
     // Dispose the previous asset if present.
-    if (rootMesh) {
-        rootMesh.dispose();
-    }
+    disposeAsset();
+
+    const load = { plugin: null, cancelled: false };
+    currentLoad = load;
+
+    // Load the asset from the input URL. Keep the loader plugin so that
+    // `cancelAsset` can abort its pending requests.
+    const meshes = await new Promise((resolve, reject) => {
+        load.plugin = BABYLON.SceneLoader.ImportMesh(
+            null,
+            url,
+            undefined,
+            scene,
+            (meshes) => resolve(meshes),
+            undefined,
+            (_, message, exception) => reject(exception || new Error(message))
+        );
+    });
+    throwIfCancelled(load);
+    rootMesh = meshes[0];
 
-    // Load the asset from the input URL.
-    const result = await BABYLON.SceneLoader.ImportMeshAsync(null, url, undefined, scene);
-    rootMesh = result.meshes[0];
+    await renderAssetAsync(load);
+}
+
+/**
+ * Loads and renders an asset from a scene snapshot captured by
+ * `captureSnapshotAsync`. `snapshot.buffers` view the snapshot file mapped by
+ * `App.cpp`, so restoring it only parses the small JSON description.
+ */
+async function loadAndRenderSnapshotAsync(snapshot) {
+    const description = JSON.parse(snapshot.description);
+
+    // Dispose the previous asset if present.
+    disposeAsset();
 
+    const load = { plugin: null, cancelled: false };
+    currentLoad = load;
+
+    restoreSnapshot(description, snapshot.buffers);
+
+    await renderAssetAsync(load);
+}
+
+/**
+ * Renders the loaded asset into the output texture.
+ */
+async function renderAssetAsync(load) {
     // Create a default camera that looks at the asset from a specific angle
     // and outputs to the render target created in `startup` above.
     scene.createDefaultCamera(true, true);
@@ -66,7 +177,272 @@ async function loadAndRenderAssetAsync(url) {
 
     // Wait until the scene is ready before rendering the frame.
     await scene.whenReadyAsync();
+    throwIfCancelled(load);
 
     // Render one frame.
     scene.render();
+    currentLoad = null;
+}
+
+/**
+ * Aborts the asset that is loading and disposes the parts of it that were
+ * already added to the scene. Called by `App.cpp` when an asset fails or
+ * times out so that the next asset starts from an empty scene.
+ */
+function cancelAsset() {
+    if (currentLoad) {
+        currentLoad.cancelled = true;
+        if (currentLoad.plugin && currentLoad.plugin.dispose) {
+            currentLoad.plugin.dispose();
+        }
+        currentLoad = null;
+    }
+
+    disposeAsset();
+}
+
+/**
+ * Disposes all meshes and animations of the current asset, including the
+ * ones of a partially loaded asset.
+ */
+function disposeAsset() {
+    while (scene.meshes.length > 0) {
+        scene.meshes[scene.meshes.length - 1].dispose(false, true);
+    }
+
+    while (scene.animationGroups.length > 0) {
+        scene.animationGroups[0].dispose();
+    }
+
+    rootMesh = null;
+}
+
+/**
+ * Stops a load that `cancelAsset` has cancelled from touching the scene.
+ */
+function throwIfCancelled(load) {
+    if (load.cancelled) {
+        throw new Error("Load cancelled");
+    }
+}
+
+/**
+ * Renders one frame of a turntable animation around the loaded asset.
+ */
+function renderTurntableFrame(frameIndex, frameCount) {
+    scene.activeCamera.alpha = 2 + (2 * Math.PI * frameIndex) / frameCount;
+    scene.render();
+}
+
+/**
+ * Captures the loaded asset as a snapshot: a JSON description of its meshes,
+ * materials and textures plus the binary buffers it refers to. Vertex data is
+ * captured as tightly packed floats along with the world matrix of each mesh,
+ * and texture pixels are read back from the GPU so that loading the snapshot
+ * skips decoding. Skeletons, morph targets and animations are not captured.
+ */
+async function captureSnapshotAsync() {
+    const buffers = [];
+    const addBuffer = (view) => {
+        buffers.push(view.byteOffset === 0 && view.byteLength === view.buffer.byteLength ? view.buffer : view.slice().buffer);
+        return buffers.length - 1;
+    };
+
+    const textures = [];
+    const textureIndices = new Map();
+    const captureTextureAsync = async (texture) => {
+        if (!textureIndices.has(texture.uniqueId)) {
+            const size = texture.getSize();
+            const pixels = await texture.readPixels();
+            if (!(pixels instanceof Uint8Array)) {
+                throw new Error(`Cannot capture texture ${texture.name}`);
+            }
+
+            textureIndices.set(texture.uniqueId, textures.length);
+            textures.push({
+                width: size.width,
+                height: size.height,
+                srgb: !!(texture._texture && texture._texture._useSRGBBuffer),
+                buffer: addBuffer(pixels),
+            });
+        }
+        return textureIndices.get(texture.uniqueId);
+    };
+
+    const materials = [];
+    const materialIndices = new Map();
+    const captureMaterialAsync = async (material) => {
+        if (!materialIndices.has(material.uniqueId)) {
+            // Textures are replaced by references to the captured pixels, so
+            // that parsing the material does not load them again.
+            const json = material.serialize();
+            const activeTextures = new Map(material.getActiveTextures().map((texture) => [texture.name, texture]));
+            const textureSlots = [];
+            for (const { path, owner, key } of findSerializedTextures(json, activeTextures)) {
+                const slot = { path: path, texture: await captureTextureAsync(activeTextures.get(owner[key].name)), properties: {} };
+                for (const property of SNAPSHOT_TEXTURE_PROPERTIES) {
+                    if (owner[key][property] !== undefined) {
+                        slot.properties[property] = owner[key][property];
+                    }
+                }
+                textureSlots.push(slot);
+                delete owner[key];
+            }
+
+            materialIndices.set(material.uniqueId, materials.length);
+            materials.push({ json: json, textureSlots: textureSlots });
+        }
+        return materialIndices.get(material.uniqueId);
+    };
+
+    const geometries = [];
+    const geometryIndices = new Map();
+    const captureGeometry = (mesh) => {
+        if (!geometryIndices.has(mesh.uniqueId)) {
+            const vertexBuffers = mesh
+                .getVerticesDataKinds()
+                .filter((kind) => !SNAPSHOT_SKIPPED_KINDS.includes(kind))
+                .map((kind) => {
+                    const data = mesh.getVerticesData(kind, false, true);
+                    return {
+                        kind: kind,
+                        size: mesh.getVertexBuffer(kind).getSize(),
+                        buffer: addBuffer(data instanceof Float32Array ? data : Float32Array.from(data)),
+                    };
+                });
+
+            geometryIndices.set(mesh.uniqueId, geometries.length);
+            geometries.push({
+                totalVertices: mesh.getTotalVertices(),
+                vertexBuffers: vertexBuffers,
+                indices: addBuffer(Uint32Array.from(mesh.getIndices(false, true))),
+                subMeshes: mesh.subMeshes.map((subMesh) => [subMesh.materialIndex, subMesh.verticesStart, subMesh.verticesCount, subMesh.indexStart, subMesh.indexCount]),
+            });
+        }
+        return geometryIndices.get(mesh.uniqueId);
+    };
+
+    const meshes = [];
+    for (const mesh of scene.meshes) {
+        if (!mesh.isEnabled() || !mesh.isVisible || mesh.getTotalVertices() === 0) {
+            continue;
+        }
+
+        // Instances share the geometry and material of their source mesh.
+        const sourceMesh = mesh instanceof BABYLON.InstancedMesh ? mesh.sourceMesh : mesh;
+        meshes.push({
+            name: mesh.name,
+            worldMatrix: Array.from(mesh.computeWorldMatrix(true).toArray()),
+            geometry: captureGeometry(sourceMesh),
+            material: sourceMesh.material ? await captureMaterialAsync(sourceMesh.material) : -1,
+        });
+    }
+
+    return {
+        description: JSON.stringify({
+            textures: textures,
+            materials: materials,
+            geometries: geometries,
+            meshes: meshes,
+        }),
+        buffers: buffers,
+    };
+}
+
+/**
+ * Finds the textures of a serialized material, including the ones of its
+ * plugins, by matching them to the active textures of the material.
+ */
+function findSerializedTextures(json, activeTextures, path = [], result = []) {
+    for (const [key, value] of Object.entries(json)) {
+        if (value && typeof value === "object") {
+            if (typeof value.name === "string" && activeTextures.has(value.name)) {
+                result.push({ path: [...path, key], owner: json, key: key });
+            } else {
+                findSerializedTextures(value, activeTextures, [...path, key], result);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Creates the meshes, materials and textures of a snapshot description. The
+ * vertex, index and pixel data are typed array views of `buffers`.
+ */
+function restoreSnapshot(description, buffers) {
+    // One GPU texture per captured texture, shared by the material slots that
+    // use it with their own sampling properties.
+    const internalTextures = description.textures.map(() => null);
+    const createTexture = (index) => {
+        const texture = description.textures[index];
+        if (!internalTextures[index]) {
+            const rawTexture = new BABYLON.RawTexture(
+                new Uint8Array(buffers[texture.buffer]),
+                texture.width,
+                texture.height,
+                BABYLON.Constants.TEXTUREFORMAT_RGBA,
+                scene,
+                true,
+                false,
+                BABYLON.Texture.TRILINEAR_SAMPLINGMODE,
+                BABYLON.Constants.TEXTURETYPE_UNSIGNED_BYTE,
+                undefined,
+                texture.srgb
+            );
+            internalTextures[index] = rawTexture.getInternalTexture();
+            return rawTexture;
+        }
+
+        const sharedTexture = new BABYLON.Texture(null, scene);
+        sharedTexture._texture = internalTextures[index];
+        internalTextures[index].incrementReferences();
+        return sharedTexture;
+    };
+
+    const materials = description.materials.map(({ json, textureSlots }) => {
+        const material = BABYLON.Material.Parse(json, scene, "");
+        for (const { path, texture, properties } of textureSlots) {
+            const owner = resolveTextureOwner(material, path);
+            if (owner) {
+                owner[path[path.length - 1]] = Object.assign(createTexture(texture), properties);
+            }
+        }
+        return material;
+    });
+
+    for (const { name, worldMatrix, geometry, material } of description.meshes) {
+        const { totalVertices, vertexBuffers, indices, subMeshes } = description.geometries[geometry];
+
+        const mesh = new BABYLON.Mesh(name, scene);
+        for (const { kind, size, buffer } of vertexBuffers) {
+            mesh.setVerticesData(kind, new Float32Array(buffers[buffer]), false, size);
+        }
+        mesh.setIndices(new Uint32Array(buffers[indices]), totalVertices);
+
+        mesh.subMeshes = [];
+        for (const [materialIndex, verticesStart, verticesCount, indexStart, indexCount] of subMeshes) {
+            new BABYLON.SubMesh(materialIndex, verticesStart, verticesCount, indexStart, indexCount, mesh);
+        }
+
+        mesh.material = material >= 0 ? materials[material] : null;
+        mesh.freezeWorldMatrix(BABYLON.Matrix.FromArray(worldMatrix));
+    }
+}
+
+/**
+ * Returns the object that holds the texture at `path` in a parsed material.
+ * Serialized plugins are stored under `plugins` by class name.
+ */
+function resolveTextureOwner(material, path) {
+    let owner = material;
+    for (let i = 0; owner && i < path.length - 1; i++) {
+        if (owner === material && path[i] === "plugins") {
+            const className = path[++i];
+            owner = material.pluginManager && material.pluginManager._plugins.find((plugin) => plugin.getClassName() === className);
+        } else {
+            owner = owner[path[i]];
+        }
+    }
+    return owner;
 }
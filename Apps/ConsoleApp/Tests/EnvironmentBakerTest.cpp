@@ -0,0 +1,294 @@
+// Checks that EnvironmentBaker decodes Radiance HDR images, and that baking
+// writes the `.env` layout with the irradiance and the prefiltered faces of
+// known environments, and prints how long a 256x256 cube takes to bake.
+
+#include "EnvironmentBaker.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr uint8_t MAGIC_BYTES[] = {0x86, 0x16, 0x87, 0x96, 0xf6, 0xd6, 0x96, 0x36};
+
+    bool Check(bool condition, const std::string& label)
+    {
+        std::cout << (condition ? "PASS " : "FAIL ") << label << std::endl;
+        return condition;
+    }
+
+    bool IsClose(double actual, double expected, double tolerance)
+    {
+        return std::abs(actual - expected) <= tolerance;
+    }
+
+    // Stores the raw RGBA8 pixels after the size instead of a PNG, so that the
+    // faces can be decoded without an image codec.
+    std::vector<uint8_t> EncodeRaw(const Image& image)
+    {
+        std::vector<uint8_t> data(8);
+        std::memcpy(data.data(), &image.Width, 4);
+        std::memcpy(data.data() + 4, &image.Height, 4);
+        data.insert(data.end(), image.Pixels.begin(), image.Pixels.end());
+        return data;
+    }
+
+    struct Environment
+    {
+        std::string Manifest;
+        std::vector<uint8_t> Data;
+        size_t BinaryStart;
+    };
+
+    Environment Parse(std::vector<uint8_t> data)
+    {
+        if (data.size() < sizeof(MAGIC_BYTES) || std::memcmp(data.data(), MAGIC_BYTES, sizeof(MAGIC_BYTES)) != 0)
+        {
+            throw std::runtime_error{"Missing magic bytes"};
+        }
+
+        const char* manifest = reinterpret_cast<const char*>(data.data() + sizeof(MAGIC_BYTES));
+        const size_t manifestSize = strnlen(manifest, data.size() - sizeof(MAGIC_BYTES));
+        return {std::string{manifest, manifestSize}, std::move(data), sizeof(MAGIC_BYTES) + manifestSize + 1};
+    }
+
+    // The value of `"name":[x,y,z]` in the manifest.
+    std::vector<double> ReadVector(const Environment& environment, const std::string& name)
+    {
+        const auto start = environment.Manifest.find("\"" + name + "\":[");
+        if (start == std::string::npos)
+        {
+            throw std::runtime_error{"Missing " + name};
+        }
+
+        std::vector<double> values{};
+        const char* cursor = environment.Manifest.c_str() + start + name.size() + 4;
+        for (int i = 0; i < 3; i++)
+        {
+            char* end = nullptr;
+            values.push_back(std::strtod(cursor, &end));
+            cursor = end + 1;
+        }
+        return values;
+    }
+
+    // The positions and lengths of the face images, in manifest order.
+    std::vector<std::pair<size_t, size_t>> ReadMipmaps(const Environment& environment)
+    {
+        std::vector<std::pair<size_t, size_t>> mipmaps{};
+        for (size_t start = environment.Manifest.find("{\"length\":"); start != std::string::npos; start = environment.Manifest.find("{\"length\":", start + 1))
+        {
+            char* end = nullptr;
+            const size_t length = std::strtoull(environment.Manifest.c_str() + start + 10, &end, 10);
+            const size_t position = std::strtoull(end + std::strlen(",\"position\":"), nullptr, 10);
+            mipmaps.emplace_back(position, length);
+        }
+        return mipmaps;
+    }
+
+    // Decodes every texel of a face like Babylon.js decodes RGBD, and checks
+    // it with `check(red, green, blue)`.
+    bool CheckFace(const Environment& environment, const std::pair<size_t, size_t>& mipmap, const std::function<bool(double, double, double)>& check)
+    {
+        const uint8_t* data = environment.Data.data() + environment.BinaryStart + mipmap.first;
+        uint32_t width, height;
+        std::memcpy(&width, data, 4);
+        std::memcpy(&height, data + 4, 4);
+
+        for (size_t i = 0; i < size_t{width} * height; i++)
+        {
+            const uint8_t* pixel = data + 8 + i * 4;
+            const auto decode = [pixel](size_t c) {
+                return std::pow(pixel[c] / 255.0, 2.2) / (pixel[3] / 255.0);
+            };
+            if (!check(decode(0), decode(1), decode(2)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    EnvironmentBaker::HdrImage CreatePanorama(uint32_t width, uint32_t height, const std::function<float(uint32_t, uint32_t, size_t)>& radiance)
+    {
+        EnvironmentBaker::HdrImage panorama{width, height, std::vector<float>(size_t{width} * height * 3)};
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                for (size_t c = 0; c < 3; c++)
+                {
+                    panorama.Pixels[(size_t{y} * width + x) * 3 + c] = radiance(x, y, c);
+                }
+            }
+        }
+        return panorama;
+    }
+
+    std::vector<uint8_t> CreateHdrFile(const std::string& resolution, const std::vector<uint8_t>& pixels)
+    {
+        const std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n" + resolution + "\n";
+        std::vector<uint8_t> data{header.begin(), header.end()};
+        data.insert(data.end(), pixels.begin(), pixels.end());
+        return data;
+    }
+
+    bool Throws(const std::vector<uint8_t>& data)
+    {
+        try
+        {
+            EnvironmentBaker::DecodeHdr(data.data(), data.size());
+            return false;
+        }
+        catch (const std::runtime_error&)
+        {
+            return true;
+        }
+    }
+
+    bool CheckDecodeHdr()
+    {
+        bool passed = true;
+
+        // Two flat scanlines of 2 texels: 1.0, 0.5, 0.25 and black.
+        const std::vector<uint8_t> flatPixels{128, 64, 32, 129, 0, 0, 0, 0, 128, 64, 32, 129, 0, 0, 0, 0};
+        const auto flatFile = CreateHdrFile("-Y 2 +X 2", flatPixels);
+        const auto flat = EnvironmentBaker::DecodeHdr(flatFile.data(), flatFile.size());
+        passed &= Check(flat.Width == 2 && flat.Height == 2 && flat.Pixels[0] == 1.0f && flat.Pixels[1] == 0.5f && flat.Pixels[2] == 0.25f && flat.Pixels[3] == 0.0f,
+            "decode flat scanlines");
+
+        // One run-length encoded scanline of 8 texels of 2.0, 1.0, 0.5, with
+        // the red channel as a run and the others as literals.
+        std::vector<uint8_t> rlePixels{2, 2, 0, 8, 128 + 8, 128, 8};
+        rlePixels.insert(rlePixels.end(), 8, 64);
+        rlePixels.push_back(8);
+        rlePixels.insert(rlePixels.end(), 8, 32);
+        rlePixels.insert(rlePixels.end(), {128 + 8, 130});
+        const auto rleFile = CreateHdrFile("-Y 1 +X 8", rlePixels);
+        const auto rle = EnvironmentBaker::DecodeHdr(rleFile.data(), rleFile.size());
+        passed &= Check(rle.Width == 8 && rle.Height == 1 && rle.Pixels[21] == 2.0f && rle.Pixels[22] == 1.0f && rle.Pixels[23] == 0.5f, "decode run-length encoded scanlines");
+
+        auto truncated = flatFile;
+        truncated.pop_back();
+        passed &= Check(Throws(truncated), "reject truncated pixels");
+        passed &= Check(Throws(CreateHdrFile("+Y 2 +X 2", flatPixels)), "reject other orientations");
+
+        std::vector<uint8_t> overrun(64, 0);
+        const uint8_t overrunStart[] = {2, 2, 0, 8, 128 + 9, 128};
+        std::memcpy(overrun.data(), overrunStart, sizeof(overrunStart));
+        passed &= Check(Throws(CreateHdrFile("-Y 1 +X 8", overrun)), "reject runs past the end of a scanline");
+
+        const std::string notHdr = "P6\n2 2\n255\n";
+        passed &= Check(Throws({notHdr.begin(), notHdr.end()}), "reject other formats");
+
+        return passed;
+    }
+
+    // A uniform environment is its own prefiltered radiance at every level,
+    // and its irradiance polynomial is the constant radiance.
+    bool CheckUniform()
+    {
+        const float radiance[] = {0.5f, 1.0f, 2.0f};
+        const auto panorama = CreatePanorama(64, 32, [&radiance](uint32_t, uint32_t, size_t c) {
+            return radiance[c];
+        });
+        const auto environment = Parse(EnvironmentBaker::Bake(panorama, EncodeRaw, {32, 64}));
+
+        bool passed = true;
+        passed &= Check(environment.Manifest.find("\"width\":32") != std::string::npos, "uniform: manifest width");
+
+        const auto mipmaps = ReadMipmaps(environment);
+        bool contiguous = mipmaps.size() == 6 * 6;
+        size_t position = 0;
+        for (const auto& [mipmapPosition, length] : mipmaps)
+        {
+            contiguous &= mipmapPosition == position;
+            position += length;
+        }
+        passed &= Check(contiguous && environment.BinaryStart + position == environment.Data.size(), "uniform: 6 faces of 6 levels, back to back");
+
+        bool facesMatch = true;
+        for (const auto& mipmap : mipmaps)
+        {
+            facesMatch &= CheckFace(environment, mipmap, [&radiance](double r, double g, double b) {
+                return IsClose(r, radiance[0], radiance[0] * 0.03) && IsClose(g, radiance[1], radiance[1] * 0.03) && IsClose(b, radiance[2], radiance[2] * 0.03);
+            });
+        }
+        passed &= Check(facesMatch, "uniform: every level decodes to the radiance");
+
+        bool irradiance = true;
+        for (const auto* term : {"xx", "yy", "zz"})
+        {
+            const auto value = ReadVector(environment, term);
+            for (size_t c = 0; c < 3; c++)
+            {
+                irradiance &= IsClose(value[c], radiance[c], radiance[c] * 0.01);
+            }
+        }
+        for (const auto* term : {"x", "y", "z", "yz", "zx", "xy"})
+        {
+            for (const double value : ReadVector(environment, term))
+            {
+                irradiance &= IsClose(value, 0.0, 0.01);
+            }
+        }
+        passed &= Check(irradiance, "uniform: irradiance is the constant radiance");
+
+        return passed;
+    }
+
+    // A sky over black ground lights +Y, and a bright center of the panorama
+    // lights +X.
+    bool CheckOrientation()
+    {
+        bool passed = true;
+
+        const auto sky = Parse(EnvironmentBaker::Bake(CreatePanorama(64, 32, [](uint32_t, uint32_t y, size_t) {
+            return y < 16 ? 1.0f : 0.0f;
+        }),
+            EncodeRaw, {32, 64}));
+
+        const auto y = ReadVector(sky, "y");
+        const auto x = ReadVector(sky, "x");
+        const auto z = ReadVector(sky, "z");
+        passed &= Check(y[0] > 0.2 && IsClose(x[0], 0.0, 0.01) && IsClose(z[0], 0.0, 0.01), "sky: irradiance points up");
+
+        const auto mipmaps = ReadMipmaps(sky);
+        passed &= Check(CheckFace(sky, mipmaps[2], [](double r, double, double) { return IsClose(r, 1.0, 0.03); }) &&
+                            CheckFace(sky, mipmaps[3], [](double r, double, double) { return IsClose(r, 0.0, 0.01); }),
+            "sky: +Y face is the sky and -Y face is the ground");
+
+        const auto center = Parse(EnvironmentBaker::Bake(CreatePanorama(64, 32, [](uint32_t x, uint32_t, size_t) {
+            return x >= 24 && x < 40 ? 1.0f : 0.0f;
+        }),
+            EncodeRaw, {32, 64}));
+        passed &= Check(ReadVector(center, "x")[0] > 0.2 && IsClose(ReadVector(center, "z")[0], 0.0, 0.01), "center: irradiance points to +X");
+
+        return passed;
+    }
+}
+
+int main()
+{
+    bool passed = true;
+    passed &= CheckDecodeHdr();
+    passed &= CheckUniform();
+    passed &= CheckOrientation();
+
+    const auto panorama = CreatePanorama(1024, 512, [](uint32_t x, uint32_t y, size_t c) {
+        return static_cast<float>((x * 7 + y * 3 + c * 11) % 64) / 8.0f;
+    });
+    const auto start = std::chrono::steady_clock::now();
+    const auto environment = EnvironmentBaker::Bake(panorama, EncodeRaw, {});
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Baked a 1024x512 panorama into a 256x256 cube in " << elapsed.count() << " s (" << environment.size() << " bytes)" << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+# Renders healthy assets on their own, and then interleaved with an asset
+# whose buffer never arrives, a truncated glTF and a malformed glTF. Checks
+# that each faulty asset fails on its own, that the healthy assets after it
+# still render, and that they load about as fast as without the faults.
+#
+# Usage: cmake -DCONSOLE_APP=<exe> -DASSETS_DIR=<folder> -P FaultInjection.cmake
+
+set(TIMEOUT_SECONDS 5)
+
+function(asset_args OUTPUT_VARIABLE)
+    set(args)
+    foreach(ASSET ${ARGN})
+        string(REPLACE ":" ";" PARTS "${ASSET}")
+        list(GET PARTS 0 NAME)
+        list(GET PARTS 1 FILE)
+        list(APPEND args --asset "${NAME}" "file:///${ASSETS_DIR}/${FILE}")
+    endforeach()
+    set(${OUTPUT_VARIABLE} ${args} PARENT_SCOPE)
+endfunction()
+
+function(run_console_app OUTPUT_VARIABLE EXIT_CODE_VARIABLE)
+    asset_args(args ${ARGN})
+    execute_process(
+        COMMAND "${CONSOLE_APP}" --timeout ${TIMEOUT_SECONDS} ${args}
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE output
+        RESULT_VARIABLE exitCode)
+    message(STATUS "${output}")
+    set(${OUTPUT_VARIABLE} "${output}" PARENT_SCOPE)
+    set(${EXIT_CODE_VARIABLE} "${exitCode}" PARENT_SCOPE)
+endfunction()
+
+# Sums the load times of the named assets, failing if any did not load.
+function(total_load_time OUTPUT_VARIABLE OUTPUT)
+    set(total 0)
+    foreach(NAME ${ARGN})
+        if(NOT OUTPUT MATCHES "Loaded ${NAME} from glTF in ([0-9]+) ms")
+            message(FATAL_ERROR "${NAME} did not load")
+        endif()
+        math(EXPR total "${total} + ${CMAKE_MATCH_1}")
+    endforeach()
+    set(${OUTPUT_VARIABLE} ${total} PARENT_SCOPE)
+endfunction()
+
+# The first asset of a run also pays for shader compilation, so only the
+# later ones are timed.
+run_console_app(baseline baselineExitCode
+    Healthy1:Triangle.gltf
+    Healthy2:Triangle.gltf
+    Healthy3:Triangle.gltf
+    Healthy4:Triangle.gltf)
+if(NOT baselineExitCode EQUAL 0)
+    message(FATAL_ERROR "Healthy assets failed with exit code ${baselineExitCode}")
+endif()
+total_load_time(baselineTime "${baseline}" Healthy2 Healthy3 Healthy4)
+
+run_console_app(faulty faultyExitCode
+    Healthy1:Triangle.gltf
+    Slow:Slow.gltf
+    Healthy2:Triangle.gltf
+    Truncated:Truncated.gltf
+    Healthy3:Triangle.gltf
+    Malformed:Malformed.gltf
+    Healthy4:Triangle.gltf)
+if(NOT faultyExitCode EQUAL 1)
+    message(FATAL_ERROR "Expected exit code 1 with faulty assets, got ${faultyExitCode}")
+endif()
+
+foreach(NAME Slow Truncated Malformed)
+    if(NOT faulty MATCHES "FAIL ${NAME}: ")
+        message(FATAL_ERROR "${NAME} was not reported as failed")
+    endif()
+endforeach()
+
+if(NOT faulty MATCHES "3 of 7 assets failed")
+    message(FATAL_ERROR "Expected exactly the 3 faulty assets to fail")
+endif()
+
+total_load_time(faultyTime "${faulty}" Healthy2 Healthy3 Healthy4)
+message(STATUS "Healthy assets loaded in ${baselineTime} ms alone and ${faultyTime} ms between faulty ones")
+
+# Allow for noise in loads that only take a few milliseconds.
+math(EXPR limit "${baselineTime} * 2 + 100")
+if(faultyTime GREATER limit)
+    message(FATAL_ERROR "Healthy assets loaded more slowly after faulty ones (${faultyTime} ms, limit ${limit} ms)")
+endif()
@@ -13,15 +13,27 @@
 #include <ScreenGrab.h>
 #include <wincodec.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
-
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Async.h"
+#include "EnvironmentBaker.h"
+#include "FrameWriter.h"
+#include "ImageCompare.h"
+#include "MappedFile.h"
 #include "RenderDoc.h"
+#include "SceneSnapshot.h"
 
 namespace
 {
-    constexpr const uint32_t WIDTH = 1024;
-    constexpr const uint32_t HEIGHT = 1024;
+    const auto g_startTime = std::chrono::steady_clock::now();
 
     std::filesystem::path GetModulePath()
     {
@@ -31,19 +43,20 @@ namespace
         return std::filesystem::path{modulePath}.parent_path();
     }
 
-    winrt::com_ptr<ID3D11Device> CreateD3DDevice()
+    // WARP renders on the CPU, for machines without a GPU.
+    winrt::com_ptr<ID3D11Device> CreateD3DDevice(bool warp)
     {
         winrt::com_ptr<ID3D11Device> d3dDevice{};
         uint32_t flags = D3D11_CREATE_DEVICE_SINGLETHREADED | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-        winrt::check_hresult(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, flags, nullptr, 0, D3D11_SDK_VERSION, d3dDevice.put(), nullptr, nullptr));
+        winrt::check_hresult(D3D11CreateDevice(nullptr, warp ? D3D_DRIVER_TYPE_WARP : D3D_DRIVER_TYPE_HARDWARE, nullptr, flags, nullptr, 0, D3D11_SDK_VERSION, d3dDevice.put(), nullptr, nullptr));
         return d3dDevice;
     }
 
-    winrt::com_ptr<ID3D11Texture2D> CreateD3DRenderTargetTexture(ID3D11Device* d3dDevice)
+    winrt::com_ptr<ID3D11Texture2D> CreateD3DRenderTargetTexture(ID3D11Device* d3dDevice, uint32_t width, uint32_t height)
     {
         D3D11_TEXTURE2D_DESC desc{};
-        desc.Width = WIDTH;
-        desc.Height = HEIGHT;
+        desc.Width = width;
+        desc.Height = height;
         desc.MipLevels = 1;
         desc.ArraySize = 1;
         desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -58,41 +71,824 @@ namespace
         return texture;
     }
 
-    Babylon::Graphics::Device CreateGraphicsDevice(ID3D11Device* d3dDevice)
+    // Creates a single-sampled texture for resolving the multisampled render
+    // target and reading it back on the CPU.
+    winrt::com_ptr<ID3D11Texture2D> CreateD3DTexture(ID3D11Device* d3dDevice, uint32_t width, uint32_t height, D3D11_USAGE usage, uint32_t cpuAccessFlags)
+    {
+        D3D11_TEXTURE2D_DESC desc{};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.SampleDesc = {1, 0};
+        desc.Usage = usage;
+        desc.BindFlags = 0;
+        desc.CPUAccessFlags = cpuAccessFlags;
+        desc.MiscFlags = 0;
+
+        winrt::com_ptr<ID3D11Texture2D> texture;
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+        return texture;
+    }
+
+    Babylon::Graphics::Device CreateGraphicsDevice(ID3D11Device* d3dDevice, uint32_t width, uint32_t height)
     {
         Babylon::Graphics::Configuration config{};
         config.Device = d3dDevice;
-        config.Width = WIDTH;
-        config.Height = HEIGHT;
+        config.Width = width;
+        config.Height = height;
         return Babylon::Graphics::Device(config);
     }
 
-    void CatchAndLogError(Napi::Promise jsPromise)
+    // Copies the multisampled render target into CPU memory.
+    Image ReadPixels(ID3D11DeviceContext* d3dDeviceContext, ID3D11Texture2D* renderTarget, ID3D11Texture2D* resolveTexture, ID3D11Texture2D* stagingTexture)
     {
-        auto jsOnRejected = Napi::Function::New(jsPromise.Env(), [](const Napi::CallbackInfo& info) {
-            auto console = info.Env().Global().Get("console").As<Napi::Object>();
-            console.Get("error").As<Napi::Function>().Call(console, {info[0]});
-            std::exit(1);
+        d3dDeviceContext->ResolveSubresource(resolveTexture, 0, renderTarget, 0, DXGI_FORMAT_R8G8B8A8_UNORM);
+        d3dDeviceContext->CopyResource(stagingTexture, resolveTexture);
+
+        D3D11_TEXTURE2D_DESC desc{};
+        stagingTexture->GetDesc(&desc);
+
+        D3D11_MAPPED_SUBRESOURCE mapped{};
+        winrt::check_hresult(d3dDeviceContext->Map(stagingTexture, 0, D3D11_MAP_READ, 0, &mapped));
+
+        const size_t rowSize = size_t{desc.Width} * 4;
+        Image image{desc.Width, desc.Height, std::vector<uint8_t>(rowSize * desc.Height)};
+        for (uint32_t row = 0; row < desc.Height; row++)
+        {
+            std::memcpy(image.Pixels.data() + row * rowSize, static_cast<const uint8_t*>(mapped.pData) + row * mapped.RowPitch, rowSize);
+        }
+
+        d3dDeviceContext->Unmap(stagingTexture, 0);
+        return image;
+    }
+
+    struct Asset
+    {
+        const char* Name;
+        const char* Url;
+    };
+
+    struct Options
+    {
+        // Replaces the default assets when any are given with `--asset`.
+        std::vector<Asset> Assets{};
+
+        // Number of frames of a turntable animation to write per asset, or 0
+        // to write a single PNG.
+        uint32_t TurntableFrames{0};
+        FrameWriter::Format TurntableFormat{FrameWriter::Format::Y4M};
+
+        // Size of the render target, and so of screenshots and turntable
+        // frames.
+        uint32_t Width{1024};
+        uint32_t Height{1024};
+
+        // Whether to render with WARP instead of the GPU.
+        bool Warp{false};
+
+        // Folder of `<name>.png` reference images to compare each asset with.
+        std::optional<std::filesystem::path> CompareDirectory{};
+        double MinSsim{0.99};
+        uint8_t ChannelTolerance{2};
+
+        // How long each asset may take to load and render, or 0 to wait
+        // forever.
+        std::chrono::seconds Timeout{60};
+
+        // The prefiltered environment cache, and an HDR image to bake into it
+        // with `--bake-environment` instead of rendering assets.
+        std::filesystem::path EnvironmentPath{};
+        std::optional<std::filesystem::path> BakeEnvironmentPath{};
+
+        // How long loading the environment from the cache, and downloading
+        // it when the cache is unusable, may each take, or 0 to wait forever.
+        std::chrono::seconds EnvironmentTimeout{120};
+
+        // Folder of scene snapshots to load assets from, and to capture them
+        // into when they are missing.
+        std::optional<std::filesystem::path> SnapshotDirectory{};
+
+        // Number of JavaScript calls to time with `--benchmark-dispatch`
+        // instead of rendering assets.
+        uint32_t DispatchBenchmarkCount{0};
+    };
+
+    Options ParseOptions(int argc, char* argv[])
+    {
+        Options options{};
+        options.EnvironmentPath = GetModulePath() / "Environment.env";
+        for (int i = 1; i + 1 < argc; i++)
+        {
+            if (std::strcmp(argv[i], "--asset") == 0 && i + 2 < argc)
+            {
+                options.Assets.push_back({argv[i + 1], argv[i + 2]});
+                i += 2;
+            }
+            else if (std::strcmp(argv[i], "--turntable") == 0)
+            {
+                options.TurntableFrames = std::stoul(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+            {
+                options.Width = std::stoul(argv[i + 1]);
+                options.Height = std::stoul(argv[i + 2]);
+                i += 2;
+            }
+            else if (std::strcmp(argv[i], "--device") == 0)
+            {
+                options.Warp = std::strcmp(argv[++i], "warp") == 0;
+            }
+            else if (std::strcmp(argv[i], "--format") == 0)
+            {
+                options.TurntableFormat = std::strcmp(argv[++i], "png") == 0 ? FrameWriter::Format::PngSequence : FrameWriter::Format::Y4M;
+            }
+            else if (std::strcmp(argv[i], "--compare") == 0)
+            {
+                options.CompareDirectory = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--min-ssim") == 0)
+            {
+                options.MinSsim = std::stod(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--tolerance") == 0)
+            {
+                options.ChannelTolerance = static_cast<uint8_t>(std::stoul(argv[++i]));
+            }
+            else if (std::strcmp(argv[i], "--timeout") == 0)
+            {
+                options.Timeout = std::chrono::seconds{std::stoul(argv[++i])};
+            }
+            else if (std::strcmp(argv[i], "--environment") == 0)
+            {
+                options.EnvironmentPath = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--bake-environment") == 0)
+            {
+                options.BakeEnvironmentPath = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--environment-timeout") == 0)
+            {
+                options.EnvironmentTimeout = std::chrono::seconds{std::stoul(argv[++i])};
+            }
+            else if (std::strcmp(argv[i], "--snapshots") == 0)
+            {
+                options.SnapshotDirectory = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--benchmark-dispatch") == 0)
+            {
+                options.DispatchBenchmarkCount = std::stoul(argv[++i]);
+            }
+        }
+        return options;
+    }
+
+    // Compares the rendered asset with its reference image and writes a diff
+    // image next to the executable if they do not match. Returns whether
+    // they match.
+    bool CompareWithReference(const Options& options, const char* name, const Image& rendered)
+    {
+        auto referencePath = *options.CompareDirectory / name;
+        referencePath.concat(".png");
+        if (!std::filesystem::exists(referencePath))
+        {
+            std::cout << "FAIL " << name << ": missing reference " << referencePath.string() << std::endl;
+            return false;
+        }
+
+        const Image reference = ImageIO::Load(referencePath);
+        if (reference.Width != rendered.Width || reference.Height != rendered.Height)
+        {
+            std::cout << "FAIL " << name << ": reference is " << reference.Width << "x" << reference.Height << std::endl;
+            return false;
+        }
+
+        Image diff{};
+        const auto result = ImageCompare::Compare(rendered, reference, options.ChannelTolerance, &diff);
+        const bool match = result.Ssim >= options.MinSsim;
+
+        std::cout << (match ? "PASS " : "FAIL ") << name << ": PSNR " << result.Psnr << " dB, SSIM " << result.Ssim
+                  << ", " << result.DifferentPixels << " pixels differ" << std::endl;
+
+        if (!match)
+        {
+            auto diffPath = GetModulePath() / name;
+            diffPath.concat(".diff.png");
+            ImageIO::SavePng(diff, diffPath);
+        }
+
+        return match;
+    }
+
+    std::filesystem::path GetSnapshotPath(const Options& options, const Asset& asset)
+    {
+        auto filePath = *options.SnapshotDirectory / asset.Name;
+        filePath.concat(".snapshot");
+        return filePath;
+    }
+
+    // Maps the snapshot of an asset if there is a valid one.
+    std::shared_ptr<SceneSnapshot::Reader> OpenSnapshot(const Options& options, const Asset& asset)
+    {
+        if (!options.SnapshotDirectory)
+        {
+            return nullptr;
+        }
+
+        const auto filePath = GetSnapshotPath(options, asset);
+        if (!std::filesystem::exists(filePath))
+        {
+            return nullptr;
+        }
+
+        try
+        {
+            // Checking the source here unmaps a stale snapshot right away,
+            // so that it can be captured again.
+            auto snapshot = std::make_shared<SceneSnapshot::Reader>(filePath);
+            if (snapshot->Source() != asset.Url)
+            {
+                std::cout << "Ignoring snapshot " << filePath.string() << ": captured from " << snapshot->Source() << std::endl;
+                return nullptr;
+            }
+            return snapshot;
+        }
+        catch (const std::exception& exception)
+        {
+            std::cout << "Ignoring snapshot " << filePath.string() << ": " << exception.what() << std::endl;
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            std::cout << "Ignoring snapshot " << filePath.string() << ": " << winrt::to_string(error.message()) << std::endl;
+        }
+        return nullptr;
+    }
+
+    // Creates the JavaScript object for `loadAndRenderSnapshotAsync`. Its
+    // buffers view the mapped snapshot, which stays mapped until JavaScript
+    // has collected all of them.
+    Napi::Object CreateJsSnapshot(Napi::Env env, const std::shared_ptr<SceneSnapshot::Reader>& snapshot)
+    {
+        const auto& buffers = snapshot->Buffers();
+        auto jsBuffers = Napi::Array::New(env, buffers.size());
+        for (uint32_t i = 0; i < buffers.size(); i++)
+        {
+            auto* reference = new std::shared_ptr<SceneSnapshot::Reader>{snapshot};
+            jsBuffers.Set(i, Napi::ArrayBuffer::New(env, buffers[i].Data, buffers[i].Size, [](Napi::Env, void*, std::shared_ptr<SceneSnapshot::Reader>* hint) { delete hint; }, reference));
+        }
+
+        auto jsSnapshot = Napi::Object::New(env);
+        jsSnapshot.Set("description", Napi::String::New(env, snapshot->Description().data(), snapshot->Description().size()));
+        jsSnapshot.Set("buffers", jsBuffers);
+        return jsSnapshot;
+    }
+
+    // Writes the object returned by `captureSnapshotAsync` to a snapshot.
+    void WriteJsSnapshot(const std::filesystem::path& filePath, const char* url, Napi::Object jsSnapshot)
+    {
+        auto jsBuffers = jsSnapshot.Get("buffers").As<Napi::Array>();
+        std::vector<SceneSnapshot::Buffer> buffers{};
+        buffers.reserve(jsBuffers.Length());
+        for (uint32_t i = 0; i < jsBuffers.Length(); i++)
+        {
+            auto jsBuffer = jsBuffers.Get(i).As<Napi::ArrayBuffer>();
+            buffers.push_back({jsBuffer.Data(), jsBuffer.ByteLength()});
+        }
+
+        std::filesystem::create_directories(filePath.parent_path());
+        SceneSnapshot::Write(filePath, url, jsSnapshot.Get("description").As<Napi::String>().Utf8Value(), buffers);
+    }
+
+    // The objects from `main` that the asynchronous host code works with.
+    // Outside of `FinishFrame` and `StartFrame` pairs, a frame is always
+    // being rendered so that JavaScript can queue graphics commands.
+    struct Context
+    {
+        const Options& Settings;
+        Babylon::Graphics::Device& Device;
+        Babylon::Graphics::DeviceUpdate& DeviceUpdate;
+        Babylon::ScriptLoader& Loader;
+        Async::Scheduler& Scheduler;
+        ID3D11Device* D3DDevice;
+        ID3D11DeviceContext* D3DDeviceContext;
+        ID3D11Texture2D* OutputTexture;
+        ID3D11Texture2D* ResolveTexture;
+        ID3D11Texture2D* StagingTexture;
+
+        // The mapped environment cache, or null if there is none yet.
+        const MappedFile* Environment;
+
+        // Whether a frame is being rendered, so that a failed asset can
+        // restore the open frame.
+        bool Rendering{true};
+
+        void StartFrame()
+        {
+            Device.StartRenderingCurrentFrame();
+            DeviceUpdate.Start();
+            Rendering = true;
+        }
+
+        void FinishFrame()
+        {
+            DeviceUpdate.Finish();
+            Device.FinishRenderingCurrentFrame();
+            Rendering = false;
+        }
+
+        Image ReadOutputPixels()
+        {
+            return ReadPixels(D3DDeviceContext, OutputTexture, ResolveTexture, StagingTexture);
+        }
+    };
+
+    // Creates an external texture for the render target texture and passes it
+    // to the `startup` JavaScript function.
+    Async::Task<> StartupAsync(Context& context)
+    {
+        // `AddToContextAsync` only completes once a frame has rendered.
+        co_await Async::DispatchAsync(context.Scheduler, context.Loader, [externalTexture = Babylon::Plugins::ExternalTexture{context.OutputTexture}, width = context.Settings.Width, height = context.Settings.Height](Napi::Env env) {
+            auto jsPromise = externalTexture.AddToContextAsync(env);
+
+            auto jsOnFulfilled = Napi::Function::New(env, [width, height](const Napi::CallbackInfo& info) {
+                auto nativeTexture = info[0];
+                info.Env().Global().Get("startup").As<Napi::Function>().Call(
+                    {
+                        nativeTexture,
+                        Napi::Value::From(info.Env(), width),
+                        Napi::Value::From(info.Env(), height),
+                    });
+            });
+
+            return jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {jsOnFulfilled}).As<Napi::Promise>();
+        },
+            Async::Frames::Render);
+    }
+
+    // Sets up the environment lighting from the mapped cache, or downloads the
+    // default environment into the cache when there is none or it does not
+    // load in time. Assets render without the environment if that fails too.
+    Async::Task<> LoadEnvironmentAsync(Context& context)
+    {
+        const auto timeout = context.Settings.EnvironmentTimeout;
+        const char* source = "from cache";
+        bool fromCache = false;
+
+        if (context.Environment != nullptr)
+        {
+            try
+            {
+                co_await Async::DispatchAsync(context.Scheduler, context.Loader, [environment = context.Environment](Napi::Env env) {
+                    // The cache is mapped for the lifetime of the runtime, so
+                    // its contents are passed to JavaScript without a copy.
+                    auto jsEnvironmentData = Napi::ArrayBuffer::New(env, environment->Data(), environment->Size());
+                    return env.Global().Get("loadEnvironmentAsync").As<Napi::Function>().Call({jsEnvironmentData}).As<Napi::Promise>();
+                },
+                    Async::Frames::Render, timeout.count() > 0 ? Async::Clock::now() + timeout : Async::NoDeadline);
+                fromCache = true;
+            }
+            catch (const Async::JsError& error)
+            {
+                std::cout << "Ignoring environment cache " << context.Settings.EnvironmentPath.string() << ": " << error.what() << std::endl;
+            }
+            catch (const Async::TimeoutError& error)
+            {
+                std::cout << "Ignoring environment cache " << context.Settings.EnvironmentPath.string() << ": " << error.what() << std::endl;
+            }
+        }
+
+        if (!fromCache)
+        {
+            source = "downloaded";
+            try
+            {
+                co_await Async::DispatchAsync(context.Scheduler, context.Loader, [](Napi::Env env) {
+                    return env.Global().Get("loadEnvironmentAsync").As<Napi::Function>().Call({env.Undefined()}).As<Napi::Promise>();
+                },
+                    Async::Frames::Render, timeout.count() > 0 ? Async::Clock::now() + timeout : Async::NoDeadline);
+            }
+            catch (const Async::JsError& error)
+            {
+                std::cout << "Failed to download the environment: " << error.what() << std::endl;
+                source = "unavailable";
+            }
+            catch (const Async::TimeoutError& error)
+            {
+                std::cout << "Failed to download the environment: " << error.what() << std::endl;
+                source = "unavailable";
+            }
+        }
+
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - g_startTime;
+        std::cout << "Ready to render after " << elapsed.count() << " ms (environment " << source << ")" << std::endl;
+    }
+
+    // Calls `loadAndRenderSnapshotAsync` with the snapshot of the asset if
+    // there is a valid one, and `loadAndRenderAssetAsync` with the asset URL
+    // otherwise, and waits for it to complete within the current frame.
+    // Returns whether the asset was loaded from its snapshot.
+    Async::Task<bool> LoadAndRenderAssetAsync(Context& context, const Asset& asset, Async::Clock::time_point deadline)
+    {
+        std::cout << "Loading " << asset.Name << std::endl;
+
+        const auto start = std::chrono::steady_clock::now();
+        bool fromSnapshot = false;
+
+        if (auto snapshot = OpenSnapshot(context.Settings, asset))
+        {
+            try
+            {
+                co_await Async::DispatchAsync(context.Scheduler, context.Loader, [snapshot](Napi::Env env) {
+                    return env.Global().Get("loadAndRenderSnapshotAsync").As<Napi::Function>().Call({CreateJsSnapshot(env, snapshot)}).As<Napi::Promise>();
+                },
+                    Async::Frames::Hold, deadline);
+                fromSnapshot = true;
+            }
+            catch (const Async::JsError& error)
+            {
+                std::cout << "Ignoring snapshot of " << asset.Name << ": " << error.what() << std::endl;
+            }
+        }
+
+        if (!fromSnapshot)
+        {
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, [url = asset.Url](Napi::Env env) {
+                return env.Global().Get("loadAndRenderAssetAsync").As<Napi::Function>().Call({Napi::String::From(env, url)}).As<Napi::Promise>();
+            },
+                Async::Frames::Hold, deadline);
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Loaded " << asset.Name << (fromSnapshot ? " from snapshot" : " from glTF") << " in " << elapsed.count() << " ms" << std::endl;
+
+        co_return fromSnapshot;
+    }
+
+    // Captures the loaded asset into its snapshot. Failing or timing out does
+    // not fail the asset, which has already been rendered.
+    Async::Task<> CaptureSnapshotAsync(Context& context, const Asset& asset)
+    {
+        const auto deadline = context.Settings.Timeout.count() > 0 ? Async::Clock::now() + context.Settings.Timeout : Async::NoDeadline;
+
+        const auto filePath = GetSnapshotPath(context.Settings, asset);
+        std::cout << "Capturing snapshot " << filePath.string() << std::endl;
+
+        try
+        {
+            // Texture pixels are read back from the GPU, which needs frames.
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, [filePath, url = asset.Url](Napi::Env env) {
+                auto jsPromise = env.Global().Get("captureSnapshotAsync").As<Napi::Function>().Call({}).As<Napi::Promise>();
+
+                auto jsOnFulfilled = Napi::Function::New(env, [filePath, url](const Napi::CallbackInfo& info) {
+                    try
+                    {
+                        WriteJsSnapshot(filePath, url, info[0].As<Napi::Object>());
+                    }
+                    catch (const std::exception& exception)
+                    {
+                        throw Napi::Error::New(info.Env(), exception.what());
+                    }
+                });
+
+                return jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {jsOnFulfilled}).As<Napi::Promise>();
+            },
+                Async::Frames::Render, deadline);
+        }
+        catch (const Async::JsError& error)
+        {
+            std::cout << "Failed to capture snapshot of " << asset.Name << ": " << error.what() << std::endl;
+        }
+        catch (const Async::TimeoutError& error)
+        {
+            std::cout << "Failed to capture snapshot of " << asset.Name << ": " << error.what() << std::endl;
+        }
+    }
+
+    Napi::Promise CreateResolvedPromise(Napi::Env env)
+    {
+        auto deferred = Napi::Promise::Deferred::New(env);
+        deferred.Resolve(env.Undefined());
+        return deferred.Promise();
+    }
+
+    void PrintLatencies(const char* label, std::vector<double> microseconds)
+    {
+        std::sort(microseconds.begin(), microseconds.end());
+        double total = 0;
+        for (const auto value : microseconds)
+        {
+            total += value;
+        }
+
+        std::cout << label << ": mean " << total / microseconds.size() << " us, median " << microseconds[microseconds.size() / 2]
+                  << " us, 99th percentile " << microseconds[microseconds.size() * 99 / 100] << " us" << std::endl;
+    }
+
+    Async::Task<> DispatchSequenceAsync(Context& context, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, CreateResolvedPromise);
+        }
+    }
+
+    // Times the round trip from a coroutine to the JavaScript thread and back,
+    // one call at a time, the interval between awaited frames, and the
+    // throughput with many calls in flight.
+    Async::Task<> BenchmarkDispatchAsync(Context& context, uint32_t count)
+    {
+        std::vector<double> callLatencies{};
+        std::vector<double> promiseLatencies{};
+        callLatencies.reserve(count);
+        promiseLatencies.reserve(count);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            auto start = Async::Clock::now();
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, [](Napi::Env) {});
+            callLatencies.push_back(std::chrono::duration<double, std::micro>(Async::Clock::now() - start).count());
+
+            start = Async::Clock::now();
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, CreateResolvedPromise);
+            promiseLatencies.push_back(std::chrono::duration<double, std::micro>(Async::Clock::now() - start).count());
+        }
+
+        PrintLatencies("Round trip of a call", std::move(callLatencies));
+        PrintLatencies("Round trip of a promise", std::move(promiseLatencies));
+
+        // Host code that awaits frames gets them at the paced interval.
+        constexpr int FRAME_COUNT = 60;
+        std::vector<double> frameIntervals{};
+        auto previousFrame = Async::Clock::now();
+        for (int i = 0; i < FRAME_COUNT; i++)
+        {
+            co_await context.Scheduler.NextFrame();
+            const auto now = Async::Clock::now();
+            frameIntervals.push_back(std::chrono::duration<double, std::micro>(now - previousFrame).count());
+            previousFrame = now;
+        }
+
+        PrintLatencies("Awaited frame interval", std::move(frameIntervals));
+
+        for (const uint32_t inFlight : {1u, 4u, 16u, 64u, 256u})
+        {
+            const uint32_t perJob = std::max(count / inFlight, 1u);
+
+            std::vector<Async::Task<>> jobs{};
+            for (uint32_t i = 0; i < inFlight; i++)
+            {
+                jobs.push_back(DispatchSequenceAsync(context, perJob));
+            }
+
+            const auto start = Async::Clock::now();
+            co_await Async::WhenAll(std::move(jobs));
+            const std::chrono::duration<double> elapsed = Async::Clock::now() - start;
+
+            const double calls = static_cast<double>(inFlight) * perJob;
+            std::cout << inFlight << " in flight: " << calls / elapsed.count() << " promises/s, mean latency "
+                      << elapsed.count() * 1e6 * inFlight / calls << " us" << std::endl;
+        }
+    }
+
+    // Aborts the pending loads of a failed asset and disposes whatever part
+    // of it made it into the scene. Renders a frame so that the next asset
+    // starts from a clean frame.
+    Async::Task<> CancelAssetAsync(Context& context)
+    {
+        if (!context.Rendering)
+        {
+            context.StartFrame();
+        }
+
+        co_await Async::DispatchAsync(context.Scheduler, context.Loader, [](Napi::Env env) {
+            env.Global().Get("cancelAsset").As<Napi::Function>().Call({});
         });
 
-        jsPromise.Get("catch").As<Napi::Function>().Call(jsPromise, {jsOnRejected});
+        context.FinishFrame();
+        context.StartFrame();
+    }
+
+    // Writes the turntable animation of the loaded asset. Expects the frame
+    // with the asset to have just finished. Each frame may take up to
+    // `--timeout` to render.
+    Async::Task<> WriteTurntableAsync(Context& context, const Asset& asset)
+    {
+        const auto frameCount = context.Settings.TurntableFrames;
+        const auto timeout = context.Settings.Timeout;
+
+        auto outputPath = GetModulePath() / asset.Name;
+        if (context.Settings.TurntableFormat == FrameWriter::Format::Y4M)
+        {
+            outputPath.concat(".y4m");
+        }
+        std::cout << "Writing " << frameCount << " frames to " << outputPath.string() << std::endl;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        // Frames are encoded and written on the writer's threads while
+        // the next frame renders.
+        FrameWriter writer{outputPath, context.Settings.TurntableFormat, context.Settings.Width, context.Settings.Height, 30};
+        writer.Push(context.ReadOutputPixels());
+
+        for (uint32_t frame = 1; frame < frameCount; frame++)
+        {
+            context.StartFrame();
+
+            // Call `renderTurntableFrame` with the frame index.
+            co_await Async::DispatchAsync(context.Scheduler, context.Loader, [frame, frameCount](Napi::Env env) {
+                env.Global().Get("renderTurntableFrame").As<Napi::Function>().Call({Napi::Value::From(env, frame), Napi::Value::From(env, frameCount)});
+            },
+                Async::Frames::Hold, timeout.count() > 0 ? Async::Clock::now() + timeout : Async::NoDeadline);
+
+            context.FinishFrame();
+            writer.Push(context.ReadOutputPixels());
+        }
+
+        writer.Finish();
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Wrote " << writer.FramesWritten() << " frames of " << context.Settings.Width << "x" << context.Settings.Height << " in " << elapsed.count() << " s ("
+                  << writer.FramesWritten() / elapsed.count() << " frames/s" << (context.Settings.Warp ? " with WARP" : "") << ")" << std::endl;
+    }
+
+    // Renders one asset and writes its output. Returns false if it does not
+    // match its reference image.
+    Async::Task<bool> RenderAssetAsync(Context& context, const Asset& asset)
+    {
+        const auto deadline = context.Settings.Timeout.count() > 0 ? Async::Clock::now() + context.Settings.Timeout : Async::NoDeadline;
+
+        // Tell RenderDoc to start capturing.
+        RenderDoc::StartFrameCapture(context.D3DDevice);
+
+        bool fromSnapshot = false;
+        try
+        {
+            fromSnapshot = co_await LoadAndRenderAssetAsync(context, asset, deadline);
+        }
+        catch (...)
+        {
+            // Close the capture of the failed frame before the asset is cancelled.
+            RenderDoc::StopFrameCapture(context.D3DDevice);
+            throw;
+        }
+
+        // Finish rendering the frame.
+        context.FinishFrame();
+
+        // Tell RenderDoc to stop capturing.
+        RenderDoc::StopFrameCapture(context.D3DDevice);
+
+        bool match = true;
+        if (context.Settings.TurntableFrames > 0)
+        {
+            co_await WriteTurntableAsync(context, asset);
+        }
+        else
+        {
+            // Save the texture into an PNG next to the executable.
+            auto filePath = GetModulePath() / asset.Name;
+            filePath.concat(".png");
+            std::cout << "Writing " << filePath.string() << std::endl;
+
+            // See https://github.com/Microsoft/DirectXTK/wiki/ScreenGrab#srgb-vs-linear-color-space
+            winrt::check_hresult(DirectX::SaveWICTextureToFile(context.D3DDeviceContext, context.OutputTexture, GUID_ContainerFormatPng, filePath.c_str(), nullptr, nullptr, true));
+
+            if (context.Settings.CompareDirectory)
+            {
+                match = CompareWithReference(context.Settings, asset.Name, context.ReadOutputPixels());
+            }
+        }
+
+        // Start rendering a frame to unblock the JavaScript again.
+        context.StartFrame();
+
+        if (context.Settings.SnapshotDirectory && !fromSnapshot)
+        {
+            co_await CaptureSnapshotAsync(context, asset);
+        }
+
+        co_return match;
+    }
+
+    // Prefilters the HDR image into the environment cache on the CPU. Returns
+    // the exit code.
+    int BakeEnvironment(const Options& options)
+    {
+        std::cout << "Baking " << options.BakeEnvironmentPath->string() << " into " << options.EnvironmentPath.string() << std::endl;
+
+        try
+        {
+            // WIC encodes the faces, and requires COM on this thread.
+            winrt::init_apartment();
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto data = EnvironmentBaker::Bake(EnvironmentBaker::LoadHdr(*options.BakeEnvironmentPath), ImageIO::EncodePng, {});
+            WriteMappedFile(options.EnvironmentPath, [&data](std::ostream& stream) {
+                stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+            });
+
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "Baked " << data.size() << " bytes in " << elapsed.count() << " s" << std::endl;
+            return 0;
+        }
+        catch (const std::exception& exception)
+        {
+            std::cout << "Failed to bake the environment: " << exception.what() << std::endl;
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            std::cout << "Failed to bake the environment: " << winrt::to_string(error.message()) << std::endl;
+        }
+        return 1;
+    }
+
+    Async::Task<int> RunAsync(Context& context, const std::vector<Asset>& assets)
+    {
+        co_await StartupAsync(context);
+
+        if (context.Settings.DispatchBenchmarkCount > 0)
+        {
+            co_await BenchmarkDispatchAsync(context, context.Settings.DispatchBenchmarkCount);
+            context.FinishFrame();
+            co_return 0;
+        }
+
+        co_await LoadEnvironmentAsync(context);
+
+        size_t failures = 0;
+        for (const auto& asset : assets)
+        {
+            // A failed asset is reported and cancelled, and the runtime moves
+            // on to the next one.
+            bool succeeded = false;
+            std::optional<std::string> error{};
+            try
+            {
+                succeeded = co_await RenderAssetAsync(context, asset);
+            }
+            catch (const std::exception& exception)
+            {
+                error = exception.what();
+            }
+            catch (const winrt::hresult_error& hresultError)
+            {
+                error = winrt::to_string(hresultError.message());
+            }
+
+            if (error)
+            {
+                std::cout << "FAIL " << asset.Name << ": " << *error << std::endl;
+                co_await CancelAssetAsync(context);
+            }
+
+            if (!succeeded)
+            {
+                failures++;
+            }
+        }
+
+        context.FinishFrame();
+
+        if (context.Settings.CompareDirectory)
+        {
+            std::cout << (assets.size() - failures) << " of " << assets.size() << " assets match their references" << std::endl;
+        }
+        else if (failures > 0)
+        {
+            std::cout << failures << " of " << assets.size() << " assets failed" << std::endl;
+        }
+
+        co_return failures == 0 ? 0 : 1;
     }
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    const Options options = ParseOptions(argc, argv);
+    if (options.CompareDirectory && options.TurntableFrames > 0)
+    {
+        std::cerr << "--compare cannot be combined with --turntable" << std::endl;
+        return 1;
+    }
+
+    if (options.BakeEnvironmentPath)
+    {
+        return BakeEnvironment(options);
+    }
+
     // Initialize RenderDoc.
     RenderDoc::Init();
 
     // Create a DirectX device.
-    auto d3dDevice = CreateD3DDevice();
+    auto d3dDevice = CreateD3DDevice(options.Warp);
 
     // Get the immediate context for DirectXTK when saving the texture.
     winrt::com_ptr<ID3D11DeviceContext> d3dDeviceContext;
     d3dDevice->GetImmediateContext(d3dDeviceContext.put());
 
     // Create the Babylon Native graphics device and update.
-    auto device = CreateGraphicsDevice(d3dDevice.get());
+    auto device = CreateGraphicsDevice(d3dDevice.get(), options.Width, options.Height);
     auto deviceUpdate = device.GetUpdate("update");
 
     // Start rendering a frame to unblock the JavaScript from queuing graphics
@@ -100,13 +896,60 @@ int main()
     device.StartRenderingCurrentFrame();
     deviceUpdate.Start();
 
+    // Run the host code as coroutines on this thread. Frames are rendered
+    // here whenever JavaScript work needs them to progress. The scheduler
+    // outlives the runtime since JavaScript work that timed out may still
+    // complete.
+    Async::Scheduler scheduler{[&device, &deviceUpdate]() {
+        deviceUpdate.Finish();
+        device.FinishRenderingCurrentFrame();
+        device.StartRenderingCurrentFrame();
+        deviceUpdate.Start();
+    }};
+
+    // Map the prefiltered environment cache if there is one. The mapping must
+    // outlive the runtime since JavaScript references it directly. A cache
+    // that cannot be mapped is downloaded again.
+    std::optional<MappedFile> environment{};
+    if (std::filesystem::exists(options.EnvironmentPath))
+    {
+        try
+        {
+            environment.emplace(options.EnvironmentPath);
+        }
+        catch (const std::exception& exception)
+        {
+            std::cout << "Ignoring environment cache " << options.EnvironmentPath.string() << ": " << exception.what() << std::endl;
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            std::cout << "Ignoring environment cache " << options.EnvironmentPath.string() << ": " << winrt::to_string(error.message()) << std::endl;
+        }
+    }
+
     // Create a Babylon Native application runtime which hosts a JavaScript
     // engine on a new thread.
     Babylon::AppRuntime runtime{};
-    runtime.Dispatch([&device](Napi::Env env) {
+    runtime.Dispatch([&device, environmentPath = options.EnvironmentPath](Napi::Env env) {
         // Add the Babylon Native graphics device to the JavaScript environment.
         device.AddToJavaScript(env);
 
+        // Add a `saveEnvironment` function that writes prefiltered environment
+        // data to the cache, which may be mapped if it failed to load.
+        env.Global().Set("saveEnvironment", Napi::Function::New(env, [environmentPath](const Napi::CallbackInfo& info) {
+            auto jsEnvironmentData = info[0].As<Napi::ArrayBuffer>();
+            try
+            {
+                WriteMappedFile(environmentPath, [&jsEnvironmentData](std::ostream& stream) {
+                    stream.write(static_cast<const char*>(jsEnvironmentData.Data()), jsEnvironmentData.ByteLength());
+                });
+            }
+            catch (const std::exception& exception)
+            {
+                throw Napi::Error::New(info.Env(), exception.what());
+            }
+        }));
+
         // Initialize the console polyfill.
         Babylon::Polyfills::Console::Initialize(env, [](const char* message, auto) {
             std::cout << message;
@@ -125,99 +968,37 @@ int main()
     loader.LoadScript("app:///Scripts/index.js");
 
     // Create a render target texture for the output.
-    winrt::com_ptr<ID3D11Texture2D> outputTexture = CreateD3DRenderTargetTexture(d3dDevice.get());
-
-    std::promise<void> addToContext{};
-    std::promise<void> startup{};
-
-    // Create an external texture for the render target texture and pass it to
-    // the `startup` JavaScript function.
-    loader.Dispatch([externalTexture = Babylon::Plugins::ExternalTexture{outputTexture.get()}, &addToContext, &startup](Napi::Env env) {
-        auto jsPromise = externalTexture.AddToContextAsync(env);
-        addToContext.set_value();
-
-        auto jsOnFulfilled = Napi::Function::New(env, [&startup](const Napi::CallbackInfo& info) {
-            auto nativeTexture = info[0];
-            info.Env().Global().Get("startup").As<Napi::Function>().Call(
-                {
-                    nativeTexture,
-                    Napi::Value::From(info.Env(), WIDTH),
-                    Napi::Value::From(info.Env(), HEIGHT),
-                });
-            startup.set_value();
-        });
-
-        jsPromise = jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {jsOnFulfilled}).As<Napi::Promise>();
-
-        CatchAndLogError(jsPromise);
-    });
+    winrt::com_ptr<ID3D11Texture2D> outputTexture = CreateD3DRenderTargetTexture(d3dDevice.get(), options.Width, options.Height);
 
-    // Wait for `AddToContextAsync` to be called.
-    addToContext.get_future().wait();
-
-    // Render a frame so that `AddToContextAsync` will complete.
-    deviceUpdate.Finish();
-    device.FinishRenderingCurrentFrame();
-
-    // Wait for `startup` to finish.
-    startup.get_future().wait();
-
-    struct Asset
-    {
-        const char* Name;
-        const char* Url;
-    };
+    // Create the textures used to read back frames on the CPU.
+    winrt::com_ptr<ID3D11Texture2D> resolveTexture = CreateD3DTexture(d3dDevice.get(), options.Width, options.Height, D3D11_USAGE_DEFAULT, 0);
+    winrt::com_ptr<ID3D11Texture2D> stagingTexture = CreateD3DTexture(d3dDevice.get(), options.Width, options.Height, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_READ);
 
-    std::array<Asset, 3> assets = {
+    std::vector<Asset> assets = {
         Asset{"BoomBox", "https://raw.githubusercontent.com/KhronosGroup/glTF-Sample-Models/master/2.0/BoomBox/glTF/BoomBox.gltf"},
         Asset{"GlamVelvetSofa", "https://raw.githubusercontent.com/KhronosGroup/glTF-Sample-Models/master/2.0/GlamVelvetSofa/glTF/GlamVelvetSofa.gltf"},
         Asset{"MaterialsVariantsShoe", "https://raw.githubusercontent.com/KhronosGroup/glTF-Sample-Models/master/2.0/MaterialsVariantsShoe/glTF/MaterialsVariantsShoe.gltf"},
     };
 
-    for (const auto& asset : assets)
+    if (!options.Assets.empty())
     {
-        // Tell RenderDoc to start capturing.
-        RenderDoc::StartFrameCapture(d3dDevice.get());
-
-        // Start rendering a frame to unblock the JavaScript again.
-        device.StartRenderingCurrentFrame();
-        deviceUpdate.Start();
-
-        std::promise<void> loadAndRenderAsset{};
-
-        // Call `loadAndRenderAssetAsync` with the asset URL.
-        loader.Dispatch([&loadAndRenderAsset, &asset](Napi::Env env) {
-            std::cout << "Loading " << asset.Name << std::endl;
-
-            auto jsPromise = env.Global().Get("loadAndRenderAssetAsync").As<Napi::Function>().Call({Napi::String::From(env, asset.Url)}).As<Napi::Promise>();
-
-            auto jsOnFulfilled = Napi::Function::New(env, [&loadAndRenderAsset](const Napi::CallbackInfo&) {
-                loadAndRenderAsset.set_value();
-            });
-
-            jsPromise = jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {jsOnFulfilled}).As<Napi::Promise>();
-
-            CatchAndLogError(jsPromise);
-        });
-
-        // Wait for the function to complete.
-        loadAndRenderAsset.get_future().wait();
-
-        // Finish rendering the frame.
-        deviceUpdate.Finish();
-        device.FinishRenderingCurrentFrame();
-
-        // Tell RenderDoc to stop capturing.
-        RenderDoc::StopFrameCapture(d3dDevice.get());
+        assets = options.Assets;
+    }
 
-        // Save the texture into an PNG next to the executable.
-        auto filePath = GetModulePath() / asset.Name;
-        filePath.concat(".png");
-        std::cout << "Writing " << filePath.string() << std::endl;
+    Context context{options, device, deviceUpdate, loader, scheduler, d3dDevice.get(), d3dDeviceContext.get(), outputTexture.get(), resolveTexture.get(), stagingTexture.get(), environment ? &*environment : nullptr};
 
-        // See https://github.com/Microsoft/DirectXTK/wiki/ScreenGrab#srgb-vs-linear-color-space
-        winrt::check_hresult(DirectX::SaveWICTextureToFile(d3dDeviceContext.get(), outputTexture.get(), GUID_ContainerFormatPng, filePath.c_str(), nullptr, nullptr, true));
+    try
+    {
+        return scheduler.Run(RunAsync(context, assets));
+    }
+    catch (const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    catch (const winrt::hresult_error& error)
+    {
+        std::cerr << winrt::to_string(error.message()) << std::endl;
+        return 1;
     }
-
-    return 0;
 }
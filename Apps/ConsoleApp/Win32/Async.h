@@ -0,0 +1,662 @@
+#pragma once
+
+#include <Babylon/ScriptLoader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Coroutine support for host code that waits on the JavaScript thread.
+//
+// All coroutines run on the thread that calls `Scheduler::Run`. Awaiting
+// JavaScript work suspends the coroutine instead of blocking that thread, so
+// any number of jobs can be waiting at once without a thread each.
+namespace Async
+{
+    // A rejected JavaScript promise or an exception thrown by JavaScript.
+    class JsError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // JavaScript work that did not settle before its deadline.
+    class TimeoutError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // The deadline of work that may wait forever.
+    constexpr Clock::time_point NoDeadline = Clock::time_point::max();
+
+    // The shortest time between frames rendered for pending JavaScript work.
+    constexpr Clock::duration DefaultFrameInterval = std::chrono::milliseconds{16};
+
+    template<typename T = void>
+    class Task;
+
+    namespace Detail
+    {
+        struct PromiseBase
+        {
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                template<typename PromiseT>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<PromiseT> handle) noexcept
+                {
+                    auto continuation = handle.promise().Continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept
+                {
+                }
+            };
+
+            std::suspend_always initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            FinalAwaiter final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception() noexcept
+            {
+                Exception = std::current_exception();
+            }
+
+            std::coroutine_handle<> Continuation{};
+            std::exception_ptr Exception{};
+        };
+
+        template<typename T>
+        struct Promise : PromiseBase
+        {
+            Task<T> get_return_object();
+
+            void return_value(T value)
+            {
+                Value.emplace(std::move(value));
+            }
+
+            T Result()
+            {
+                if (Exception)
+                {
+                    std::rethrow_exception(Exception);
+                }
+                return std::move(*Value);
+            }
+
+            std::optional<T> Value{};
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase
+        {
+            Task<void> get_return_object();
+
+            void return_void()
+            {
+            }
+
+            void Result()
+            {
+                if (Exception)
+                {
+                    std::rethrow_exception(Exception);
+                }
+            }
+        };
+    }
+
+    // A lazily started coroutine. It starts when awaited or passed to
+    // `Scheduler::Run`, and exceptions propagate to the awaiter.
+    template<typename T>
+    class Task
+    {
+    public:
+        using promise_type = Detail::Promise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> handle)
+            : m_handle{handle}
+        {
+        }
+
+        Task(Task&& other) noexcept
+            : m_handle{std::exchange(other.m_handle, {})}
+        {
+        }
+
+        Task& operator=(Task&&) = delete;
+
+        ~Task()
+        {
+            if (m_handle)
+            {
+                m_handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+        {
+            m_handle.promise().Continuation = continuation;
+            return m_handle;
+        }
+
+        T await_resume()
+        {
+            return m_handle.promise().Result();
+        }
+
+    private:
+        friend class Scheduler;
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template<typename T>
+    Task<T> Detail::Promise<T>::get_return_object()
+    {
+        return Task<T>{std::coroutine_handle<Promise<T>>::from_promise(*this)};
+    }
+
+    inline Task<void> Detail::Promise<void>::get_return_object()
+    {
+        return Task<void>{std::coroutine_handle<Promise<void>>::from_promise(*this)};
+    }
+
+    namespace Detail
+    {
+        struct WhenAllState
+        {
+            size_t Remaining{};
+            std::coroutine_handle<> Continuation{};
+            std::exception_ptr Exception{};
+        };
+
+        // Runs one task of `WhenAll` and resumes the awaiter of `WhenAll`
+        // when it is the last one to complete.
+        class WhenAllItem
+        {
+        public:
+            struct promise_type
+            {
+                WhenAllItem get_return_object()
+                {
+                    return WhenAllItem{std::coroutine_handle<promise_type>::from_promise(*this)};
+                }
+
+                std::suspend_always initial_suspend() noexcept
+                {
+                    return {};
+                }
+
+                auto final_suspend() noexcept
+                {
+                    struct Awaiter
+                    {
+                        bool await_ready() noexcept
+                        {
+                            return false;
+                        }
+
+                        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                        {
+                            auto& state = *handle.promise().State;
+                            return --state.Remaining == 0 ? state.Continuation : std::noop_coroutine();
+                        }
+
+                        void await_resume() noexcept
+                        {
+                        }
+                    };
+
+                    return Awaiter{};
+                }
+
+                void return_void()
+                {
+                }
+
+                void unhandled_exception() noexcept
+                {
+                    if (!State->Exception)
+                    {
+                        State->Exception = std::current_exception();
+                    }
+                }
+
+                WhenAllState* State{};
+            };
+
+            explicit WhenAllItem(std::coroutine_handle<promise_type> handle)
+                : m_handle{handle}
+            {
+            }
+
+            WhenAllItem(WhenAllItem&& other) noexcept
+                : m_handle{std::exchange(other.m_handle, {})}
+            {
+            }
+
+            WhenAllItem& operator=(WhenAllItem&&) = delete;
+
+            ~WhenAllItem()
+            {
+                if (m_handle)
+                {
+                    m_handle.destroy();
+                }
+            }
+
+            void Start(WhenAllState& state)
+            {
+                m_handle.promise().State = &state;
+                m_handle.resume();
+            }
+
+        private:
+            std::coroutine_handle<promise_type> m_handle;
+        };
+
+        inline WhenAllItem RunWhenAllItem(Task<> task)
+        {
+            co_await task;
+        }
+
+        class WhenAllAwaiter
+        {
+        public:
+            explicit WhenAllAwaiter(std::vector<Task<>> tasks)
+                : m_tasks{std::move(tasks)}
+            {
+            }
+
+            bool await_ready() const noexcept
+            {
+                return m_tasks.empty();
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                // Count this call as one more item so that tasks completing
+                // while they are started here cannot resume the awaiter yet.
+                m_state.Remaining = m_tasks.size() + 1;
+                m_state.Continuation = handle;
+
+                m_items.reserve(m_tasks.size());
+                for (auto& task : m_tasks)
+                {
+                    m_items.push_back(RunWhenAllItem(std::move(task)));
+                    m_items.back().Start(m_state);
+                }
+
+                return --m_state.Remaining != 0;
+            }
+
+            void await_resume()
+            {
+                if (m_state.Exception)
+                {
+                    std::rethrow_exception(m_state.Exception);
+                }
+            }
+
+        private:
+            std::vector<Task<>> m_tasks;
+            std::vector<WhenAllItem> m_items{};
+            WhenAllState m_state{};
+        };
+    }
+
+    // Starts all tasks at once and completes when every one of them has. The
+    // first exception of any task is rethrown once all have completed.
+    inline Task<> WhenAll(std::vector<Task<>> tasks)
+    {
+        co_await Detail::WhenAllAwaiter{std::move(tasks)};
+    }
+
+    class Scheduler;
+
+    // Resumes the awaiting coroutine once the scheduler has rendered the next
+    // frame.
+    class FrameAwaiter
+    {
+    public:
+        explicit FrameAwaiter(Scheduler& scheduler)
+            : m_scheduler{scheduler}
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        void await_resume() noexcept
+        {
+        }
+
+    private:
+        Scheduler& m_scheduler;
+    };
+
+    // Runs coroutines on the calling thread and resumes them when the work
+    // they wait on completes on other threads.
+    class Scheduler
+    {
+    public:
+        // `renderFrame` finishes the current frame and starts the next one.
+        // It is called while a coroutine awaits JavaScript work that needs
+        // frames to progress, at most once per `frameInterval`.
+        explicit Scheduler(std::function<void()> renderFrame, Clock::duration frameInterval = DefaultFrameInterval)
+            : m_renderFrame{std::move(renderFrame)}
+            , m_frameInterval{frameInterval}
+        {
+        }
+
+        // Queues work to run on the scheduler thread. Safe to call from any
+        // thread.
+        void Post(std::function<void()> work)
+        {
+            {
+                std::scoped_lock lock{m_mutex};
+                m_work.push_back(std::move(work));
+            }
+            m_workAvailable.notify_one();
+        }
+
+        // Completes once the next frame has rendered. The frame is paced like
+        // the frames rendered for pending JavaScript work.
+        FrameAwaiter NextFrame()
+        {
+            return FrameAwaiter{*this};
+        }
+
+        // Runs the task and any work it posts until it completes.
+        template<typename T>
+        T Run(Task<T> task)
+        {
+            task.m_handle.resume();
+            while (!task.m_handle.done())
+            {
+                RunOne();
+            }
+            return task.m_handle.promise().Result();
+        }
+
+    private:
+        template<typename CallableT>
+        friend class DispatchAwaiter;
+        friend class FrameAwaiter;
+
+        using Timers = std::multimap<Clock::time_point, std::function<void()>>;
+
+        void RunOne()
+        {
+            if (RunDueTimer())
+            {
+                return;
+            }
+
+            // Frames for pending JavaScript work are paced rather than
+            // rendered back to back, which would keep the CPU and GPU busy
+            // while the work waits on something else, such as the network.
+            const bool frameNeeded = m_frameRequests > 0 || !m_frameWaiters.empty();
+            const auto nextFrame = m_lastFrame + m_frameInterval;
+            if (frameNeeded && Clock::now() >= nextFrame)
+            {
+                RenderFrame();
+                return;
+            }
+
+            std::function<void()> work;
+            {
+                std::unique_lock lock{m_mutex};
+                auto wakeTime = frameNeeded ? nextFrame : NoDeadline;
+                if (!m_timers.empty())
+                {
+                    wakeTime = std::min(wakeTime, m_timers.begin()->first);
+                }
+
+                const auto hasWork = [this] { return !m_work.empty(); };
+                if (wakeTime == NoDeadline)
+                {
+                    m_workAvailable.wait(lock, hasWork);
+                }
+                else if (!m_workAvailable.wait_until(lock, wakeTime, hasWork))
+                {
+                    // The next frame or the earliest timer is due.
+                    return;
+                }
+
+                work = std::move(m_work.front());
+                m_work.pop_front();
+            }
+
+            work();
+        }
+
+        bool RunDueTimer()
+        {
+            if (m_timers.empty() || m_timers.begin()->first > Clock::now())
+            {
+                return false;
+            }
+
+            auto timer = std::move(m_timers.begin()->second);
+            m_timers.erase(m_timers.begin());
+            timer();
+            return true;
+        }
+
+        void RenderFrame()
+        {
+            m_lastFrame = Clock::now();
+            m_renderFrame();
+
+            // A waiter that awaits again waits for the frame after this one.
+            for (auto handle : std::exchange(m_frameWaiters, {}))
+            {
+                handle.resume();
+            }
+        }
+
+        const std::function<void()> m_renderFrame;
+        const Clock::duration m_frameInterval;
+
+        std::mutex m_mutex{};
+        std::condition_variable m_workAvailable{};
+        std::deque<std::function<void()>> m_work{};
+
+        // Only used on the scheduler thread.
+        int m_frameRequests{0};
+        Clock::time_point m_lastFrame{};
+        Timers m_timers{};
+        std::vector<std::coroutine_handle<>> m_frameWaiters{};
+    };
+
+    inline void FrameAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        m_scheduler.m_frameWaiters.push_back(handle);
+    }
+
+    // Whether JavaScript work needs frames to render while it is pending, as
+    // with promises that only settle once the graphics device has rendered.
+    enum class Frames
+    {
+        Hold,
+        Render,
+    };
+
+    template<typename CallableT>
+    class DispatchAwaiter
+    {
+    public:
+        DispatchAwaiter(Scheduler& scheduler, Babylon::ScriptLoader& loader, CallableT callable, Frames frames, Clock::time_point deadline)
+            : m_scheduler{scheduler}
+            , m_loader{loader}
+            , m_callable{std::move(callable)}
+            , m_frames{frames}
+            , m_deadline{deadline}
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            if (m_frames == Frames::Render)
+            {
+                m_scheduler.m_frameRequests++;
+            }
+
+            m_state = std::make_shared<State>();
+            m_state->Handle = handle;
+
+            if (m_deadline != NoDeadline)
+            {
+                m_state->Timer = m_scheduler.m_timers.emplace(m_deadline, [state = m_state]() {
+                    state->Timer.reset();
+                    Resume(*state, std::make_exception_ptr(TimeoutError{"Timed out waiting for JavaScript"}));
+                });
+            }
+
+            // Called on the JavaScript thread; resumes the coroutine on the
+            // scheduler thread unless the deadline has already passed.
+            auto complete = [scheduler = &m_scheduler, state = m_state](std::exception_ptr exception) {
+                scheduler->Post([scheduler, state, exception]() {
+                    if (state->Timer)
+                    {
+                        scheduler->m_timers.erase(*state->Timer);
+                        state->Timer.reset();
+                    }
+
+                    Resume(*state, exception);
+                });
+            };
+
+            m_loader.Dispatch([callable = std::move(m_callable), complete](Napi::Env env) {
+                try
+                {
+                    if constexpr (std::is_void_v<std::invoke_result_t<CallableT, Napi::Env>>)
+                    {
+                        callable(env);
+                        complete(nullptr);
+                    }
+                    else
+                    {
+                        Napi::Promise jsPromise = callable(env);
+
+                        auto jsOnFulfilled = Napi::Function::New(env, [complete](const Napi::CallbackInfo&) {
+                            complete(nullptr);
+                        });
+
+                        auto jsOnRejected = Napi::Function::New(env, [complete](const Napi::CallbackInfo& info) {
+                            complete(std::make_exception_ptr(JsError{info[0].ToString().Utf8Value()}));
+                        });
+
+                        jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {jsOnFulfilled, jsOnRejected});
+                    }
+                }
+                catch (const Napi::Error& error)
+                {
+                    complete(std::make_exception_ptr(JsError{error.Message()}));
+                }
+                catch (...)
+                {
+                    complete(std::current_exception());
+                }
+            });
+        }
+
+        void await_resume()
+        {
+            if (m_frames == Frames::Render)
+            {
+                m_scheduler.m_frameRequests--;
+            }
+
+            if (m_state->Error)
+            {
+                std::rethrow_exception(m_state->Error);
+            }
+        }
+
+    private:
+        // Shared with the JavaScript callbacks and the deadline timer, which
+        // may outlive the awaiter. Only used on the scheduler thread.
+        struct State
+        {
+            std::coroutine_handle<> Handle{};
+            std::exception_ptr Error{};
+            bool Resumed{false};
+            std::optional<Scheduler::Timers::iterator> Timer{};
+        };
+
+        // Resumes the coroutine with the first of completion or timeout.
+        static void Resume(State& state, std::exception_ptr error)
+        {
+            if (!state.Resumed)
+            {
+                state.Resumed = true;
+                state.Error = error;
+                state.Handle.resume();
+            }
+        }
+
+        Scheduler& m_scheduler;
+        Babylon::ScriptLoader& m_loader;
+        CallableT m_callable;
+        const Frames m_frames;
+        const Clock::time_point m_deadline;
+        std::shared_ptr<State> m_state{};
+    };
+
+    // Runs `callable` on the JavaScript thread. If it returns a promise, the
+    // awaiting coroutine resumes when the promise settles and a rejection is
+    // rethrown as `JsError`; otherwise it resumes once `callable` returns.
+    // If neither happens by `deadline`, the coroutine resumes with a
+    // `TimeoutError` and any later completion is ignored. The JavaScript work
+    // itself keeps running; aborting it is up to the caller.
+    template<typename CallableT>
+    DispatchAwaiter<CallableT> DispatchAsync(Scheduler& scheduler, Babylon::ScriptLoader& loader, CallableT callable, Frames frames = Frames::Hold, Clock::time_point deadline = NoDeadline)
+    {
+        return {scheduler, loader, std::move(callable), frames, deadline};
+    }
+}
@@ -0,0 +1,623 @@
+#include "EnvironmentBaker.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+    constexpr double PI = 3.14159265358979323846;
+
+    // Starts every `.env` file.
+    constexpr std::array<uint8_t, 8> MAGIC_BYTES{0x86, 0x16, 0x87, 0x96, 0xf6, 0xd6, 0x96, 0x36};
+
+    // Babylon.js prefilters its own environments with this scale, and the PBR
+    // materials pick the level for a roughness with it.
+    constexpr double LOD_GENERATION_SCALE = 0.8;
+
+    // Radiance above this is clamped when computing the irradiance, the same
+    // as Babylon.js does, since 9 spherical harmonics cannot represent a
+    // very bright, small light anyway.
+    constexpr float MAX_IRRADIANCE_RADIANCE = 4096.0f;
+
+    constexpr uint32_t FACE_COUNT = 6;
+
+    struct Vector
+    {
+        double X;
+        double Y;
+        double Z;
+    };
+
+    Vector Normalize(const Vector& v)
+    {
+        const double length = std::sqrt(v.X * v.X + v.Y * v.Y + v.Z * v.Z);
+        return {v.X / length, v.Y / length, v.Z / length};
+    }
+
+    Vector Cross(const Vector& a, const Vector& b)
+    {
+        return {a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z, a.X * b.Y - a.Y * b.X};
+    }
+
+    // RGB texels of each face, row by row from the top.
+    struct Cube
+    {
+        uint32_t Size;
+        std::array<std::vector<float>, FACE_COUNT> Faces;
+    };
+
+    Cube CreateCube(uint32_t size)
+    {
+        Cube cube{size, {}};
+        for (auto& face : cube.Faces)
+        {
+            face.resize(size_t{size} * size * 3);
+        }
+        return cube;
+    }
+
+    // The direction through a point of a face, with `a` and `b` from -1 at
+    // the left and top to 1 at the right and bottom, the same as GPUs and
+    // Babylon.js lay out cube map faces.
+    Vector FaceDirection(uint32_t face, double a, double b)
+    {
+        switch (face)
+        {
+            case 0:
+                return {1, -b, -a};
+            case 1:
+                return {-1, -b, a};
+            case 2:
+                return {a, 1, b};
+            case 3:
+                return {a, -1, -b};
+            case 4:
+                return {a, -b, 1};
+            default:
+                return {-a, -b, -1};
+        }
+    }
+
+    Vector TexelDirection(uint32_t face, uint32_t x, uint32_t y, uint32_t size)
+    {
+        return Normalize(FaceDirection(face, 2.0 * (x + 0.5) / size - 1.0, 2.0 * (y + 0.5) / size - 1.0));
+    }
+
+    // Returns the nearest texel of `cube` in the direction `v`.
+    const float* SampleCube(const Cube& cube, const Vector& v)
+    {
+        const double absX = std::abs(v.X);
+        const double absY = std::abs(v.Y);
+        const double absZ = std::abs(v.Z);
+
+        uint32_t face;
+        double major, s, t;
+        if (absX >= absY && absX >= absZ)
+        {
+            face = v.X > 0 ? 0 : 1;
+            major = absX;
+            s = v.X > 0 ? -v.Z : v.Z;
+            t = -v.Y;
+        }
+        else if (absY >= absZ)
+        {
+            face = v.Y > 0 ? 2 : 3;
+            major = absY;
+            s = v.X;
+            t = v.Y > 0 ? v.Z : -v.Z;
+        }
+        else
+        {
+            face = v.Z > 0 ? 4 : 5;
+            major = absZ;
+            s = v.Z > 0 ? v.X : -v.X;
+            t = -v.Y;
+        }
+
+        const auto toTexel = [size = cube.Size](double coordinate) {
+            return std::min(static_cast<uint32_t>(std::max((coordinate + 1.0) * 0.5 * size, 0.0)), size - 1);
+        };
+        return &cube.Faces[face][(size_t{toTexel(t / major)} * cube.Size + toTexel(s / major)) * 3];
+    }
+
+    // Bilinearly samples the panorama in the direction `v`, wrapping around
+    // horizontally.
+    std::array<float, 3> SamplePanorama(const EnvironmentBaker::HdrImage& panorama, const Vector& v)
+    {
+        const double u = std::atan2(v.Z, v.X) / (2.0 * PI) + 0.5;
+        const double w = std::acos(std::clamp(v.Y, -1.0, 1.0)) / PI;
+
+        const double x = u * panorama.Width - 0.5;
+        const double y = std::clamp(w * panorama.Height - 0.5, 0.0, panorama.Height - 1.0);
+        const double x0 = std::floor(x);
+        const double y0 = std::floor(y);
+        const double fx = x - x0;
+        const double fy = y - y0;
+
+        const auto texel = [&panorama](double tx, double ty) {
+            const auto column = static_cast<uint32_t>((static_cast<int64_t>(tx) % panorama.Width + panorama.Width) % panorama.Width);
+            const auto row = std::min(static_cast<uint32_t>(ty), panorama.Height - 1);
+            return &panorama.Pixels[(size_t{row} * panorama.Width + column) * 3];
+        };
+
+        const float* t00 = texel(x0, y0);
+        const float* t10 = texel(x0 + 1, y0);
+        const float* t01 = texel(x0, y0 + 1);
+        const float* t11 = texel(x0 + 1, y0 + 1);
+
+        std::array<float, 3> color{};
+        for (size_t c = 0; c < 3; c++)
+        {
+            const double top = t00[c] + (t10[c] - t00[c]) * fx;
+            const double bottom = t01[c] + (t11[c] - t01[c]) * fx;
+            color[c] = static_cast<float>(top + (bottom - top) * fy);
+        }
+        return color;
+    }
+
+    // Runs `process(face)` for every face on its own thread.
+    template<typename ProcessT>
+    void ForEachFace(ProcessT process)
+    {
+        std::vector<std::thread> threads{};
+        for (uint32_t face = 1; face < FACE_COUNT; face++)
+        {
+            threads.emplace_back(process, face);
+        }
+        process(0);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Projects the panorama onto a cube, averaging 4x4 samples per texel so
+    // that a panorama much larger than the cube does not alias.
+    Cube ProjectPanorama(const EnvironmentBaker::HdrImage& panorama, uint32_t size)
+    {
+        constexpr uint32_t SUBSAMPLES = 4;
+
+        Cube cube = CreateCube(size);
+        ForEachFace([&](uint32_t face) {
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    std::array<double, 3> sum{};
+                    for (uint32_t sy = 0; sy < SUBSAMPLES; sy++)
+                    {
+                        for (uint32_t sx = 0; sx < SUBSAMPLES; sx++)
+                        {
+                            const double a = 2.0 * (x + (sx + 0.5) / SUBSAMPLES) / size - 1.0;
+                            const double b = 2.0 * (y + (sy + 0.5) / SUBSAMPLES) / size - 1.0;
+                            const auto color = SamplePanorama(panorama, Normalize(FaceDirection(face, a, b)));
+                            for (size_t c = 0; c < 3; c++)
+                            {
+                                sum[c] += color[c];
+                            }
+                        }
+                    }
+
+                    float* texel = &cube.Faces[face][(size_t{y} * size + x) * 3];
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        texel[c] = static_cast<float>(sum[c] / (SUBSAMPLES * SUBSAMPLES));
+                    }
+                }
+            }
+        });
+        return cube;
+    }
+
+    // Halves the cube with a box filter.
+    Cube Downsample(const Cube& cube)
+    {
+        const uint32_t size = cube.Size / 2;
+        Cube result = CreateCube(size);
+        for (uint32_t face = 0; face < FACE_COUNT; face++)
+        {
+            const auto& source = cube.Faces[face];
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    const size_t top = (size_t{y} * 2 * cube.Size + x * 2) * 3;
+                    const size_t bottom = top + size_t{cube.Size} * 3;
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        result.Faces[face][(size_t{y} * size + x) * 3 + c] = (source[top + c] + source[top + 3 + c] + source[bottom + c] + source[bottom + 3 + c]) * 0.25f;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    double RadicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+        bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+        bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+        return bits * 2.3283064365386963e-10;
+    }
+
+    // Convolves the radiance with the GGX lobe of `alpha` around each texel's
+    // direction, which is also the view direction, like Babylon.js's own
+    // prefiltering. Each sample reads the mip level whose texels cover about
+    // as much of the sphere as the sample, which keeps few samples from
+    // showing as noise.
+    Cube Prefilter(const std::vector<Cube>& radiance, uint32_t size, double alpha, uint32_t sampleCount)
+    {
+        Cube result = CreateCube(size);
+        const double alpha2 = alpha * alpha;
+        const double texelSolidAngle = 4.0 * PI / (FACE_COUNT * static_cast<double>(radiance[0].Size) * radiance[0].Size);
+
+        ForEachFace([&](uint32_t face) {
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    const Vector n = TexelDirection(face, x, y, size);
+                    const Vector up = std::abs(n.Z) < 0.999 ? Vector{0, 0, 1} : Vector{1, 0, 0};
+                    const Vector tangent = Normalize(Cross(up, n));
+                    const Vector bitangent = Cross(n, tangent);
+
+                    std::array<double, 3> sum{};
+                    double weight = 0;
+                    for (uint32_t i = 0; i < sampleCount; i++)
+                    {
+                        const double phi = 2.0 * PI * (i + 0.5) / sampleCount;
+                        const double xi = RadicalInverse(i);
+                        const double cosTheta = std::sqrt((1.0 - xi) / (1.0 + (alpha2 - 1.0) * xi));
+                        const double sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+
+                        const double hx = sinTheta * std::cos(phi);
+                        const double hy = sinTheta * std::sin(phi);
+                        const Vector h{
+                            tangent.X * hx + bitangent.X * hy + n.X * cosTheta,
+                            tangent.Y * hx + bitangent.Y * hy + n.Y * cosTheta,
+                            tangent.Z * hx + bitangent.Z * hy + n.Z * cosTheta};
+
+                        // Reflect the view direction, which is the normal,
+                        // about the half vector.
+                        const double nDotL = 2.0 * cosTheta * cosTheta - 1.0;
+                        if (nDotL <= 0)
+                        {
+                            continue;
+                        }
+                        const Vector l{2.0 * cosTheta * h.X - n.X, 2.0 * cosTheta * h.Y - n.Y, 2.0 * cosTheta * h.Z - n.Z};
+
+                        // With the view along the normal, the pdf of `l` is
+                        // D(h) / 4.
+                        const double denominator = cosTheta * cosTheta * (alpha2 - 1.0) + 1.0;
+                        const double pdf = alpha2 / (PI * denominator * denominator) / 4.0;
+                        const double sampleSolidAngle = 1.0 / (sampleCount * pdf);
+                        const double lod = std::max(0.5 * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+                        const auto level = std::min(static_cast<size_t>(std::lround(lod)), radiance.size() - 1);
+
+                        const float* color = SampleCube(radiance[level], l);
+                        for (size_t c = 0; c < 3; c++)
+                        {
+                            sum[c] += color[c] * nDotL;
+                        }
+                        weight += nDotL;
+                    }
+
+                    float* texel = &result.Faces[face][(size_t{y} * size + x) * 3];
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        texel[c] = static_cast<float>(weight > 0 ? sum[c] / weight : 0.0);
+                    }
+                }
+            }
+        });
+        return result;
+    }
+
+    // Signed area of the projection onto the unit sphere of the face
+    // rectangle from the face center to (x, y).
+    double AreaElement(double x, double y)
+    {
+        return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0));
+    }
+
+    // The spherical polynomial of the irradiance, with the same projection
+    // onto spherical harmonics and the same conversions as Babylon.js uses
+    // for the textures it loads. Returns x, y, z, xx, yy, zz, yz, zx, xy.
+    std::array<std::array<double, 3>, 9> ComputeIrradiance(const Cube& cube)
+    {
+        // Real spherical harmonics up to the second band, in Babylon.js's
+        // order l00, l1-1, l10, l11, l2-2, l2-1, l20, l21, l22.
+        const std::array<double, 9> basis{
+            std::sqrt(1.0 / (4.0 * PI)),
+            -std::sqrt(3.0 / (4.0 * PI)),
+            std::sqrt(3.0 / (4.0 * PI)),
+            -std::sqrt(3.0 / (4.0 * PI)),
+            std::sqrt(15.0 / (4.0 * PI)),
+            -std::sqrt(15.0 / (4.0 * PI)),
+            std::sqrt(5.0 / (16.0 * PI)),
+            -std::sqrt(15.0 / (4.0 * PI)),
+            std::sqrt(15.0 / (16.0 * PI)),
+        };
+
+        std::array<std::array<double, 3>, 9> harmonics{};
+        double totalSolidAngle = 0;
+
+        const double texelSize = 2.0 / cube.Size;
+        for (uint32_t face = 0; face < FACE_COUNT; face++)
+        {
+            for (uint32_t y = 0; y < cube.Size; y++)
+            {
+                const double b = (y + 0.5) * texelSize - 1.0;
+                for (uint32_t x = 0; x < cube.Size; x++)
+                {
+                    const double a = (x + 0.5) * texelSize - 1.0;
+                    const double half = texelSize / 2;
+                    const double solidAngle = AreaElement(a - half, b - half) - AreaElement(a - half, b + half) - AreaElement(a + half, b - half) + AreaElement(a + half, b + half);
+
+                    const Vector d = Normalize(FaceDirection(face, a, b));
+                    const std::array<double, 9> terms{1.0, d.Y, d.Z, d.X, d.X * d.Y, d.Y * d.Z, 3.0 * d.Z * d.Z - 1.0, d.X * d.Z, d.X * d.X - d.Y * d.Y};
+
+                    const float* texel = &cube.Faces[face][(size_t{y} * cube.Size + x) * 3];
+                    for (size_t lm = 0; lm < 9; lm++)
+                    {
+                        for (size_t c = 0; c < 3; c++)
+                        {
+                            harmonics[lm][c] += std::clamp(texel[c], 0.0f, MAX_IRRADIANCE_RADIANCE) * basis[lm] * terms[lm] * solidAngle;
+                        }
+                    }
+                    totalSolidAngle += solidAngle;
+                }
+            }
+        }
+
+        // Normalize to the whole sphere, convolve the incident radiance with
+        // the cosine lobe into irradiance, and divide by pi for the radiance
+        // of a white Lambertian surface.
+        for (size_t lm = 0; lm < 9; lm++)
+        {
+            const double convolution = lm == 0 ? PI : lm < 4 ? 2.0 * PI / 3.0 : PI / 4.0;
+            for (auto& value : harmonics[lm])
+            {
+                value *= 4.0 * PI / totalSolidAngle * convolution / PI;
+            }
+        }
+
+        const auto& [l00, l1_1, l10, l11, l2_2, l2_1, l20, l21, l22] = harmonics;
+        std::array<std::array<double, 3>, 9> polynomial{};
+        for (size_t c = 0; c < 3; c++)
+        {
+            polynomial[0][c] = -1.02333 * l11[c];
+            polynomial[1][c] = -1.02333 * l1_1[c];
+            polynomial[2][c] = 1.02333 * l10[c];
+            polynomial[3][c] = 0.886277 * l00[c] - 0.247708 * l20[c] + 0.429043 * l22[c];
+            polynomial[4][c] = 0.886277 * l00[c] - 0.247708 * l20[c] - 0.429043 * l22[c];
+            polynomial[5][c] = 0.886277 * l00[c] + 0.495417 * l20[c];
+            polynomial[6][c] = -0.858086 * l2_1[c];
+            polynomial[7][c] = -0.858086 * l21[c];
+            polynomial[8][c] = 0.858086 * l2_2[c];
+            for (auto& term : polynomial)
+            {
+                term[c] /= PI;
+            }
+        }
+        return polynomial;
+    }
+
+    // Encodes linear HDR texels into 8 bits per channel the way Babylon.js
+    // decodes them: gamma-encoded color scaled up by the largest divisor
+    // in alpha that keeps it in range.
+    Image EncodeRgbd(const std::vector<float>& texels, uint32_t size)
+    {
+        Image image{size, size, std::vector<uint8_t>(size_t{size} * size * 4)};
+        for (size_t i = 0; i < size_t{size} * size; i++)
+        {
+            const float* color = &texels[i * 3];
+            const float maxColor = std::max({color[0], color[1], color[2], 1e-7f});
+            const float divisor = std::clamp(std::floor(std::max(255.0f / maxColor, 1.0f)) / 255.0f, 0.0f, 1.0f);
+
+            uint8_t* pixel = &image.Pixels[i * 4];
+            for (size_t c = 0; c < 3; c++)
+            {
+                const float encoded = std::pow(std::max(color[c], 0.0f) * divisor, 1.0f / 2.2f);
+                pixel[c] = static_cast<uint8_t>(std::clamp(encoded, 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+            pixel[3] = static_cast<uint8_t>(divisor * 255.0f + 0.5f);
+        }
+        return image;
+    }
+
+    void WriteVector(std::ostream& stream, const char* name, const std::array<double, 3>& value)
+    {
+        stream << '"' << name << "\":[" << value[0] << ',' << value[1] << ',' << value[2] << ']';
+    }
+}
+
+EnvironmentBaker::HdrImage EnvironmentBaker::DecodeHdr(const uint8_t* data, size_t size)
+{
+    size_t offset = 0;
+    auto readLine = [&]() {
+        std::string line{};
+        while (offset < size && data[offset] != '\n')
+        {
+            line.push_back(static_cast<char>(data[offset++]));
+        }
+        if (offset == size)
+        {
+            throw std::runtime_error{"Truncated HDR header"};
+        }
+        offset++;
+        return line;
+    };
+
+    if (readLine().rfind("#?", 0) != 0)
+    {
+        throw std::runtime_error{"Not a Radiance HDR image"};
+    }
+
+    for (std::string line = readLine(); !line.empty(); line = readLine())
+    {
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+        {
+            throw std::runtime_error{"Unsupported HDR format " + line.substr(7)};
+        }
+    }
+
+    HdrImage image{};
+    {
+        std::istringstream resolution{readLine()};
+        std::string yAxis, xAxis;
+        resolution >> yAxis >> image.Height >> xAxis >> image.Width;
+        if (!resolution || yAxis != "-Y" || xAxis != "+X" || image.Width == 0 || image.Height == 0)
+        {
+            throw std::runtime_error{"Unsupported HDR orientation or size"};
+        }
+    }
+
+    auto readByte = [&]() {
+        if (offset == size)
+        {
+            throw std::runtime_error{"Truncated HDR pixels"};
+        }
+        return data[offset++];
+    };
+
+    image.Pixels.resize(size_t{image.Width} * image.Height * 3);
+    std::vector<uint8_t> scanline(size_t{image.Width} * 4);
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        // Run-length encoded scanlines start with 2, 2 and the width, and
+        // store each channel separately.
+        const bool runLengthEncoded = image.Width >= 8 && image.Width < 0x8000 && offset + 4 <= size &&
+                                      data[offset] == 2 && data[offset + 1] == 2 && ((data[offset + 2] << 8) | data[offset + 3]) == static_cast<int>(image.Width);
+        if (runLengthEncoded)
+        {
+            offset += 4;
+            for (size_t channel = 0; channel < 4; channel++)
+            {
+                for (uint32_t x = 0; x < image.Width;)
+                {
+                    uint32_t count = readByte();
+                    const bool run = count > 128;
+                    if (run)
+                    {
+                        count -= 128;
+                    }
+                    if (count == 0 || x + count > image.Width)
+                    {
+                        throw std::runtime_error{"Corrupt HDR scanline"};
+                    }
+
+                    const uint8_t value = run ? readByte() : 0;
+                    for (uint32_t i = 0; i < count; i++, x++)
+                    {
+                        scanline[size_t{x} * 4 + channel] = run ? value : readByte();
+                    }
+                }
+            }
+        }
+        else
+        {
+            for (auto& value : scanline)
+            {
+                value = readByte();
+            }
+        }
+
+        for (uint32_t x = 0; x < image.Width; x++)
+        {
+            const uint8_t* rgbe = &scanline[size_t{x} * 4];
+            const float scale = rgbe[3] == 0 ? 0.0f : std::ldexp(1.0f, rgbe[3] - (128 + 8));
+            float* texel = &image.Pixels[(size_t{y} * image.Width + x) * 3];
+            texel[0] = rgbe[0] * scale;
+            texel[1] = rgbe[1] * scale;
+            texel[2] = rgbe[2] * scale;
+        }
+    }
+
+    return image;
+}
+
+EnvironmentBaker::HdrImage EnvironmentBaker::LoadHdr(const std::filesystem::path& filePath)
+{
+    std::ifstream stream{filePath, std::ios::binary};
+    if (!stream)
+    {
+        throw std::runtime_error{"Failed to open " + filePath.string()};
+    }
+
+    const std::vector<uint8_t> data{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+    return DecodeHdr(data.data(), data.size());
+}
+
+std::vector<uint8_t> EnvironmentBaker::Bake(const HdrImage& panorama, const EncodeImage& encode, const Settings& settings)
+{
+    if (settings.CubeSize == 0 || (settings.CubeSize & (settings.CubeSize - 1)) != 0)
+    {
+        throw std::invalid_argument{"The cube size must be a power of two"};
+    }
+
+    std::vector<Cube> radiance{};
+    radiance.push_back(ProjectPanorama(panorama, settings.CubeSize));
+    while (radiance.back().Size > 1)
+    {
+        radiance.push_back(Downsample(radiance.back()));
+    }
+
+    // Level 0 is the radiance itself. Level i is filtered for the alpha that
+    // Babylon.js's PBR materials map to it.
+    std::vector<std::vector<uint8_t>> images{};
+    for (size_t level = 0; level < radiance.size(); level++)
+    {
+        const uint32_t size = radiance[level].Size;
+        const double alpha = std::min(std::pow(2.0, level / LOD_GENERATION_SCALE) / settings.CubeSize, 1.0);
+        const Cube filtered = level == 0 ? Cube{} : Prefilter(radiance, size, alpha, settings.SampleCount);
+
+        for (uint32_t face = 0; face < FACE_COUNT; face++)
+        {
+            images.push_back(encode(EncodeRgbd(level == 0 ? radiance[0].Faces[face] : filtered.Faces[face], size)));
+        }
+    }
+
+    std::ostringstream manifest{};
+    manifest.precision(std::numeric_limits<float>::max_digits10);
+    manifest << "{\"version\":1,\"width\":" << settings.CubeSize << ",\"imageType\":\"image/png\",\"irradiance\":{";
+
+    constexpr std::array<const char*, 9> TERMS{"x", "y", "z", "xx", "yy", "zz", "yz", "zx", "xy"};
+    const auto irradiance = ComputeIrradiance(radiance[0]);
+    for (size_t i = 0; i < TERMS.size(); i++)
+    {
+        manifest << (i == 0 ? "" : ",");
+        WriteVector(manifest, TERMS[i], irradiance[i]);
+    }
+
+    manifest << "},\"specular\":{\"mipmaps\":[";
+    size_t position = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        manifest << (i == 0 ? "" : ",") << "{\"length\":" << images[i].size() << ",\"position\":" << position << '}';
+        position += images[i].size();
+    }
+    manifest << "],\"lodGenerationScale\":" << LOD_GENERATION_SCALE << "}}";
+
+    const std::string json = manifest.str();
+    std::vector<uint8_t> result{MAGIC_BYTES.begin(), MAGIC_BYTES.end()};
+    result.reserve(MAGIC_BYTES.size() + json.size() + 1 + position);
+    result.insert(result.end(), json.begin(), json.end());
+    result.push_back(0);
+    for (const auto& image : images)
+    {
+        result.insert(result.end(), image.begin(), image.end());
+    }
+    return result;
+}
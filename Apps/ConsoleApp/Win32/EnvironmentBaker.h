@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+// Bakes an equirectangular HDR image into the `.env` format that
+// `BABYLON.CubeTexture` loads: the spherical polynomial of the diffuse
+// irradiance, and a cube map prefiltered for each roughness level with its
+// faces RGBD-encoded into images. Baking runs on the CPU, so it does not
+// depend on what the JavaScript engine and graphics backend support.
+//
+// Layout:
+//   8 magic bytes, UTF-8 JSON manifest, null terminator
+//   face images of each mip level, from the largest level, in cube face
+//   order +X, -X, +Y, -Y, +Z, -Z, at the offsets given in the manifest
+namespace EnvironmentBaker
+{
+    // Linear RGB texels, three floats per texel, from the top row down.
+    struct HdrImage
+    {
+        uint32_t Width;
+        uint32_t Height;
+        std::vector<float> Pixels;
+    };
+
+    // Decodes a Radiance RGBE (`.hdr`) image with flat or run-length encoded
+    // scanlines. Throws `std::runtime_error` if the data is not one.
+    HdrImage DecodeHdr(const uint8_t* data, size_t size);
+    HdrImage LoadHdr(const std::filesystem::path& filePath);
+
+    // Encodes an RGBA8 face image as PNG.
+    using EncodeImage = std::function<std::vector<uint8_t>(const Image&)>;
+
+    struct Settings
+    {
+        // Width of the largest cube face. Must be a power of two.
+        uint32_t CubeSize{256};
+        // GGX samples per texel of each prefiltered level.
+        uint32_t SampleCount{256};
+    };
+
+    // The panorama's top row is +Y, and its center faces +X.
+    std::vector<uint8_t> Bake(const HdrImage& panorama, const EncodeImage& encode, const Settings& settings);
+}
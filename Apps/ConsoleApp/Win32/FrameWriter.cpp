@@ -0,0 +1,245 @@
+#include "FrameWriter.h"
+
+#include <objbase.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    // Converts RGBA8 to planar YUV 4:2:0 with full-range BT.601 coefficients,
+    // which is what the `C420jpeg` Y4M colorspace expects.
+    void ConvertToYuv420(const Image& image, std::vector<uint8_t>& output)
+    {
+        const uint32_t width = image.Width;
+        const uint32_t height = image.Height;
+        const uint32_t chromaWidth = (width + 1) / 2;
+        const uint32_t chromaHeight = (height + 1) / 2;
+        const uint8_t* pixels = image.Pixels.data();
+
+        const size_t offset = output.size();
+        output.resize(offset + size_t{width} * height + 2 * size_t{chromaWidth} * chromaHeight);
+        uint8_t* y = output.data() + offset;
+        uint8_t* u = y + size_t{width} * height;
+        uint8_t* v = u + size_t{chromaWidth} * chromaHeight;
+
+        for (uint32_t row = 0; row < height; row++)
+        {
+            const uint8_t* src = pixels + size_t{row} * width * 4;
+            for (uint32_t col = 0; col < width; col++, src += 4)
+            {
+                *y++ = static_cast<uint8_t>((77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8);
+            }
+        }
+
+        for (uint32_t row = 0; row < chromaHeight; row++)
+        {
+            const uint32_t row0 = row * 2;
+            const uint32_t row1 = std::min(row0 + 1, height - 1);
+            for (uint32_t col = 0; col < chromaWidth; col++)
+            {
+                const uint32_t col0 = col * 2;
+                const uint32_t col1 = std::min(col0 + 1, width - 1);
+
+                int r = 0, g = 0, b = 0;
+                for (uint32_t sampleRow : {row0, row1})
+                {
+                    for (uint32_t sampleCol : {col0, col1})
+                    {
+                        const uint8_t* src = pixels + (size_t{sampleRow} * width + sampleCol) * 4;
+                        r += src[0];
+                        g += src[1];
+                        b += src[2];
+                    }
+                }
+                r = (r + 2) / 4;
+                g = (g + 2) / 4;
+                b = (b + 2) / 4;
+
+                *u++ = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 0, 255));
+                *v++ = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 0, 255));
+            }
+        }
+    }
+}
+
+FrameWriter::FrameWriter(std::filesystem::path outputPath, Format format, uint32_t width, uint32_t height, uint32_t framesPerSecond)
+    : m_outputPath{std::move(outputPath)}
+    , m_format{format}
+    , m_width{width}
+    , m_height{height}
+    , m_capacity{std::max(1u, std::thread::hardware_concurrency()) * size_t{2}}
+{
+    if (m_format == Format::Y4M)
+    {
+        m_stream.open(m_outputPath, std::ios::binary | std::ios::trunc);
+        m_stream << "YUV4MPEG2 W" << width << " H" << height << " F" << framesPerSecond << ":1 Ip A1:1 C420jpeg\n";
+        if (!m_stream)
+        {
+            throw std::runtime_error{"Failed to create " + m_outputPath.string()};
+        }
+    }
+    else
+    {
+        std::filesystem::create_directories(m_outputPath);
+    }
+
+    const auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back(&FrameWriter::EncodeLoop, this);
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    if (!m_threads.empty())
+    {
+        try
+        {
+            Finish();
+        }
+        catch (...)
+        {
+        }
+    }
+}
+
+void FrameWriter::Push(Image frame)
+{
+    if (frame.Width != m_width || frame.Height != m_height)
+    {
+        throw std::invalid_argument{"Frame size does not match the output size"};
+    }
+
+    std::unique_lock lock{m_mutex};
+    m_spaceAvailable.wait(lock, [this] { return m_inFlight < m_capacity || m_error; });
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+
+    m_jobs.push({m_nextIndex++, std::move(frame)});
+    m_inFlight++;
+    m_jobAvailable.notify_one();
+}
+
+void FrameWriter::Finish()
+{
+    {
+        std::scoped_lock lock{m_mutex};
+        m_finishing = true;
+    }
+    m_jobAvailable.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+
+    if (m_stream.is_open())
+    {
+        m_stream.close();
+        if (!m_stream && !m_error)
+        {
+            m_error = std::make_exception_ptr(std::runtime_error{"Failed to write " + m_outputPath.string()});
+        }
+    }
+
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+uint64_t FrameWriter::FramesWritten() const
+{
+    std::scoped_lock lock{m_mutex};
+    return m_written;
+}
+
+void FrameWriter::EncodeLoop()
+{
+    // WIC requires COM on the calling thread.
+    const bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock lock{m_mutex};
+            m_jobAvailable.wait(lock, [this] { return !m_jobs.empty() || m_finishing; });
+            if (m_jobs.empty())
+            {
+                break;
+            }
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop();
+        }
+
+        size_t written = 0;
+        try
+        {
+            written = Encode(job);
+        }
+        catch (...)
+        {
+            std::scoped_lock lock{m_mutex};
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+        }
+
+        {
+            std::scoped_lock lock{m_mutex};
+            m_inFlight--;
+            m_written += written;
+        }
+        m_spaceAvailable.notify_all();
+    }
+
+    if (comInitialized)
+    {
+        CoUninitialize();
+    }
+}
+
+// Returns the number of frames that reached the output, which for Y4M can
+// include earlier frames that were waiting for this one.
+size_t FrameWriter::Encode(Job& job)
+{
+    if (m_format == Format::PngSequence)
+    {
+        auto fileName = std::to_string(job.Index);
+        fileName.insert(0, fileName.size() < 5 ? 5 - fileName.size() : 0, '0');
+        ImageIO::SavePng(job.Frame, m_outputPath / (fileName + ".png"));
+        return 1;
+    }
+
+    std::vector<uint8_t> data{'F', 'R', 'A', 'M', 'E', '\n'};
+    ConvertToYuv420(job.Frame, data);
+    return WriteInOrder(job.Index, std::move(data));
+}
+
+size_t FrameWriter::WriteInOrder(uint64_t index, std::vector<uint8_t> data)
+{
+    std::scoped_lock lock{m_writeMutex};
+    m_reorder.emplace(index, std::move(data));
+
+    size_t written = 0;
+    for (auto it = m_reorder.begin(); it != m_reorder.end() && it->first == m_nextWrite; it = m_reorder.erase(it))
+    {
+        m_stream.write(reinterpret_cast<const char*>(it->second.data()), it->second.size());
+        if (!m_stream)
+        {
+            throw std::runtime_error{"Failed to write " + m_outputPath.string()};
+        }
+        m_nextWrite++;
+        written++;
+    }
+    return written;
+}
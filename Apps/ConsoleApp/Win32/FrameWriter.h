@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Image.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Writes a sequence of frames from the render loop to disk on a pool of
+// encoder threads. The number of frames in flight is bounded, so `Push`
+// blocks when the encoders fall behind instead of buffering without limit.
+class FrameWriter
+{
+public:
+    enum class Format
+    {
+        // A single YUV4MPEG2 (4:2:0) video file at `outputPath`.
+        Y4M,
+        // One numbered PNG per frame in the `outputPath` directory.
+        PngSequence,
+    };
+
+    FrameWriter(std::filesystem::path outputPath, Format format, uint32_t width, uint32_t height, uint32_t framesPerSecond);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    void Push(Image frame);
+
+    // Waits for all pushed frames to be written and stops the encoders.
+    // Throws the first error of any encoder.
+    void Finish();
+
+    // The number of frames that have reached the output so far.
+    uint64_t FramesWritten() const;
+
+private:
+    struct Job
+    {
+        uint64_t Index;
+        Image Frame;
+    };
+
+    void EncodeLoop();
+    size_t Encode(Job& job);
+    size_t WriteInOrder(uint64_t index, std::vector<uint8_t> data);
+
+    const std::filesystem::path m_outputPath;
+    const Format m_format;
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const size_t m_capacity;
+
+    mutable std::mutex m_mutex{};
+    std::condition_variable m_jobAvailable{};
+    std::condition_variable m_spaceAvailable{};
+    std::queue<Job> m_jobs{};
+    size_t m_inFlight{0};
+    uint64_t m_nextIndex{0};
+    uint64_t m_written{0};
+    bool m_finishing{false};
+    std::exception_ptr m_error{};
+
+    // Encoded Y4M frames waiting for their predecessors to be written.
+    std::mutex m_writeMutex{};
+    std::map<uint64_t, std::vector<uint8_t>> m_reorder{};
+    uint64_t m_nextWrite{0};
+    std::ofstream m_stream{};
+
+    std::vector<std::thread> m_threads{};
+};
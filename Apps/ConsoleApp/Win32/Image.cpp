@@ -0,0 +1,84 @@
+#include "Image.h"
+
+#include <winrt/base.h>
+
+#include <objbase.h>
+#include <wincodec.h>
+
+namespace
+{
+    void WritePng(IWICImagingFactory* factory, const Image& image, IStream* stream)
+    {
+        winrt::com_ptr<IWICBitmapEncoder> encoder;
+        winrt::check_hresult(factory->CreateEncoder(GUID_ContainerFormatPng, nullptr, encoder.put()));
+        winrt::check_hresult(encoder->Initialize(stream, WICBitmapEncoderNoCache));
+
+        winrt::com_ptr<IWICBitmapFrameEncode> frame;
+        winrt::check_hresult(encoder->CreateNewFrame(frame.put(), nullptr));
+        winrt::check_hresult(frame->Initialize(nullptr));
+        winrt::check_hresult(frame->SetSize(image.Width, image.Height));
+
+        WICPixelFormatGUID format = GUID_WICPixelFormat32bppRGBA;
+        winrt::check_hresult(frame->SetPixelFormat(&format));
+        winrt::check_bool(format == GUID_WICPixelFormat32bppRGBA);
+
+        const auto stride = image.Width * 4;
+        winrt::check_hresult(frame->WritePixels(image.Height, stride, stride * image.Height, const_cast<BYTE*>(image.Pixels.data())));
+        winrt::check_hresult(frame->Commit());
+        winrt::check_hresult(encoder->Commit());
+    }
+}
+
+void ImageIO::SavePng(const Image& image, const std::filesystem::path& filePath)
+{
+    auto factory = winrt::create_instance<IWICImagingFactory>(CLSID_WICImagingFactory);
+
+    winrt::com_ptr<IWICStream> stream;
+    winrt::check_hresult(factory->CreateStream(stream.put()));
+    winrt::check_hresult(stream->InitializeFromFilename(filePath.c_str(), GENERIC_WRITE));
+
+    WritePng(factory.get(), image, stream.get());
+}
+
+std::vector<uint8_t> ImageIO::EncodePng(const Image& image)
+{
+    auto factory = winrt::create_instance<IWICImagingFactory>(CLSID_WICImagingFactory);
+
+    winrt::com_ptr<IStream> stream;
+    winrt::check_hresult(CreateStreamOnHGlobal(nullptr, TRUE, stream.put()));
+
+    WritePng(factory.get(), image, stream.get());
+
+    STATSTG stat{};
+    winrt::check_hresult(stream->Stat(&stat, STATFLAG_NONAME));
+    winrt::check_hresult(stream->Seek({}, STREAM_SEEK_SET, nullptr));
+
+    std::vector<uint8_t> data(static_cast<size_t>(stat.cbSize.QuadPart));
+    ULONG bytesRead = 0;
+    winrt::check_hresult(stream->Read(data.data(), static_cast<ULONG>(data.size()), &bytesRead));
+    winrt::check_bool(bytesRead == data.size());
+    return data;
+}
+
+Image ImageIO::Load(const std::filesystem::path& filePath)
+{
+    auto factory = winrt::create_instance<IWICImagingFactory>(CLSID_WICImagingFactory);
+
+    winrt::com_ptr<IWICBitmapDecoder> decoder;
+    winrt::check_hresult(factory->CreateDecoderFromFilename(filePath.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, decoder.put()));
+
+    winrt::com_ptr<IWICBitmapFrameDecode> frame;
+    winrt::check_hresult(decoder->GetFrame(0, frame.put()));
+
+    winrt::com_ptr<IWICFormatConverter> converter;
+    winrt::check_hresult(factory->CreateFormatConverter(converter.put()));
+    winrt::check_hresult(converter->Initialize(frame.get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom));
+
+    Image image{};
+    winrt::check_hresult(converter->GetSize(&image.Width, &image.Height));
+
+    const auto stride = image.Width * 4;
+    image.Pixels.resize(size_t{stride} * image.Height);
+    winrt::check_hresult(converter->CopyPixels(nullptr, stride, static_cast<UINT>(image.Pixels.size()), image.Pixels.data()));
+    return image;
+}
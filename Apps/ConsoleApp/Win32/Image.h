@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// A CPU copy of a rendered frame with tightly packed RGBA8 pixels.
+struct Image
+{
+    uint32_t Width;
+    uint32_t Height;
+    std::vector<uint8_t> Pixels;
+};
+
+namespace ImageIO
+{
+    // Encodes the image as a PNG using WIC. May be called from any thread
+    // that has initialized COM.
+    void SavePng(const Image& image, const std::filesystem::path& filePath);
+
+    // Encodes the image as a PNG in memory, with the same requirements as
+    // `SavePng`.
+    std::vector<uint8_t> EncodePng(const Image& image);
+
+    // Decodes an image file to RGBA8 using WIC.
+    Image Load(const std::filesystem::path& filePath);
+}
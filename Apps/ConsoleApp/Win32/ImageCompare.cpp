@@ -0,0 +1,231 @@
+#include "ImageCompare.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define IMAGECOMPARE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    constexpr uint32_t SSIM_BLOCK_SIZE = 8;
+
+    struct TileResult
+    {
+        uint64_t SquaredError;
+        uint64_t DifferentPixels;
+        double SsimSum;
+        uint64_t SsimBlocks;
+    };
+
+    uint8_t AbsDiff(uint8_t a, uint8_t b)
+    {
+        return static_cast<uint8_t>(a > b ? a - b : b - a);
+    }
+
+    // Accumulates the squared error and the count of differing pixels over a
+    // run of tightly packed RGBA8 pixels, ignoring alpha.
+    void DiffPixels(const uint8_t* actual, const uint8_t* reference, uint8_t* diff, size_t byteCount, uint8_t tolerance, bool vectorized, TileResult& result)
+    {
+        size_t i = 0;
+
+#ifdef IMAGECOMPARE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        const __m128i threshold = _mm_set1_epi8(static_cast<char>(tolerance));
+
+        // Each iteration adds at most 2 * 2 * 255^2 to a 32-bit lane, so drain
+        // the accumulator into 64 bits well before it can overflow.
+        constexpr size_t DRAIN_INTERVAL = 4096;
+        size_t iterations = 0;
+        __m128i squaredError = zero;
+
+        auto drain = [&]() {
+            alignas(16) uint32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), squaredError);
+            result.SquaredError += uint64_t{lanes[0]} + lanes[1] + lanes[2] + lanes[3];
+            squaredError = zero;
+        };
+
+        for (; vectorized && i + 16 <= byteCount; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(actual + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reference + i));
+            const __m128i d = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)), rgbMask);
+
+            const __m128i low = _mm_unpacklo_epi8(d, zero);
+            const __m128i high = _mm_unpackhi_epi8(d, zero);
+            squaredError = _mm_add_epi32(squaredError, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+
+            // One bit per channel above the tolerance, folded into one bit
+            // per pixel.
+            const uint32_t over = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, threshold), zero))) & 0xFFFF;
+            result.DifferentPixels += std::bitset<16>{(over | over >> 1 | over >> 2) & 0x1111}.count();
+
+            if (diff != nullptr)
+            {
+                const __m128i doubled = _mm_adds_epu8(d, d);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(diff + i), _mm_or_si128(_mm_adds_epu8(doubled, doubled), alpha));
+            }
+
+            if (++iterations == DRAIN_INTERVAL)
+            {
+                drain();
+                iterations = 0;
+            }
+        }
+
+        drain();
+#else
+        static_cast<void>(vectorized);
+#endif
+
+        for (; i + 4 <= byteCount; i += 4)
+        {
+            bool different = false;
+            for (size_t channel = 0; channel < 3; channel++)
+            {
+                const uint8_t d = AbsDiff(actual[i + channel], reference[i + channel]);
+                result.SquaredError += uint64_t{d} * d;
+                different |= d > tolerance;
+
+                if (diff != nullptr)
+                {
+                    diff[i + channel] = static_cast<uint8_t>(std::min(d * 4, 255));
+                }
+            }
+
+            result.DifferentPixels += different ? 1 : 0;
+
+            if (diff != nullptr)
+            {
+                diff[i + 3] = 255;
+            }
+        }
+    }
+
+    double Luma(const uint8_t* pixel)
+    {
+        return (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) / 256.0;
+    }
+
+    // Accumulates the SSIM of each block in a band of block rows.
+    void SsimBlocks(const Image& actual, const Image& reference, uint32_t rowBegin, uint32_t rowEnd, TileResult& result)
+    {
+        constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+        constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+
+        for (uint32_t blockRow = rowBegin; blockRow < rowEnd; blockRow += SSIM_BLOCK_SIZE)
+        {
+            const uint32_t blockHeight = std::min(SSIM_BLOCK_SIZE, rowEnd - blockRow);
+            for (uint32_t blockCol = 0; blockCol < actual.Width; blockCol += SSIM_BLOCK_SIZE)
+            {
+                const uint32_t blockWidth = std::min(SSIM_BLOCK_SIZE, actual.Width - blockCol);
+
+                double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+                for (uint32_t row = blockRow; row < blockRow + blockHeight; row++)
+                {
+                    const size_t offset = (size_t{row} * actual.Width + blockCol) * 4;
+                    for (uint32_t col = 0; col < blockWidth; col++)
+                    {
+                        const double a = Luma(actual.Pixels.data() + offset + col * 4);
+                        const double b = Luma(reference.Pixels.data() + offset + col * 4);
+                        sumA += a;
+                        sumB += b;
+                        sumAA += a * a;
+                        sumBB += b * b;
+                        sumAB += a * b;
+                    }
+                }
+
+                const double count = static_cast<double>(blockWidth) * blockHeight;
+                const double meanA = sumA / count;
+                const double meanB = sumB / count;
+                const double varianceA = sumAA / count - meanA * meanA;
+                const double varianceB = sumBB / count - meanB * meanB;
+                const double covariance = sumAB / count - meanA * meanB;
+
+                result.SsimSum += ((2 * meanA * meanB + C1) * (2 * covariance + C2)) /
+                                  ((meanA * meanA + meanB * meanB + C1) * (varianceA + varianceB + C2));
+                result.SsimBlocks++;
+            }
+        }
+    }
+
+    ImageCompare::Result CompareImages(const Image& actual, const Image& reference, uint8_t channelTolerance, Image* diff, bool vectorized)
+    {
+        if (actual.Width != reference.Width || actual.Height != reference.Height)
+        {
+            throw std::invalid_argument{"Images must have the same size"};
+        }
+
+        if (diff != nullptr)
+        {
+            *diff = Image{actual.Width, actual.Height, std::vector<uint8_t>(actual.Pixels.size())};
+        }
+
+        // Split the image into bands of whole SSIM blocks, one per thread.
+        const uint32_t blockRows = (actual.Height + SSIM_BLOCK_SIZE - 1) / SSIM_BLOCK_SIZE;
+        const uint32_t tileCount = std::clamp(std::thread::hardware_concurrency(), 1u, std::max(blockRows, 1u));
+        const uint32_t blockRowsPerTile = (blockRows + tileCount - 1) / tileCount;
+
+        std::vector<TileResult> tiles(tileCount, TileResult{});
+        auto processTile = [&](uint32_t tile) {
+            const uint32_t rowBegin = std::min(tile * blockRowsPerTile * SSIM_BLOCK_SIZE, actual.Height);
+            const uint32_t rowEnd = std::min(rowBegin + blockRowsPerTile * SSIM_BLOCK_SIZE, actual.Height);
+            const size_t byteOffset = size_t{rowBegin} * actual.Width * 4;
+            const size_t byteCount = size_t{rowEnd - rowBegin} * actual.Width * 4;
+
+            DiffPixels(actual.Pixels.data() + byteOffset, reference.Pixels.data() + byteOffset,
+                diff != nullptr ? diff->Pixels.data() + byteOffset : nullptr, byteCount, channelTolerance, vectorized, tiles[tile]);
+            SsimBlocks(actual, reference, rowBegin, rowEnd, tiles[tile]);
+        };
+
+        std::vector<std::thread> threads{};
+        for (uint32_t tile = 1; tile < tileCount; tile++)
+        {
+            threads.emplace_back(processTile, tile);
+        }
+        processTile(0);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        TileResult total{};
+        for (const auto& tile : tiles)
+        {
+            total.SquaredError += tile.SquaredError;
+            total.DifferentPixels += tile.DifferentPixels;
+            total.SsimSum += tile.SsimSum;
+            total.SsimBlocks += tile.SsimBlocks;
+        }
+
+        const double meanSquaredError = static_cast<double>(total.SquaredError) / (static_cast<double>(actual.Width) * actual.Height * 3);
+
+        ImageCompare::Result result{};
+        result.Psnr = meanSquaredError == 0 ? std::numeric_limits<double>::infinity() : 10 * std::log10(255.0 * 255.0 / meanSquaredError);
+        result.Ssim = total.SsimBlocks == 0 ? 1.0 : total.SsimSum / total.SsimBlocks;
+        result.SquaredError = total.SquaredError;
+        result.DifferentPixels = total.DifferentPixels;
+        return result;
+    }
+}
+
+ImageCompare::Result ImageCompare::Compare(const Image& actual, const Image& reference, uint8_t channelTolerance, Image* diff)
+{
+    return CompareImages(actual, reference, channelTolerance, diff, true);
+}
+
+ImageCompare::Result ImageCompare::CompareScalar(const Image& actual, const Image& reference, uint8_t channelTolerance, Image* diff)
+{
+    return CompareImages(actual, reference, channelTolerance, diff, false);
+}
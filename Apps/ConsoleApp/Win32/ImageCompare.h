@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Image.h"
+
+#include <cstdint>
+
+// Compares a rendered image against a reference for visual regression
+// checks. The per-pixel pass is vectorized and both passes are split into
+// row tiles that run in parallel.
+namespace ImageCompare
+{
+    struct Result
+    {
+        // Peak signal-to-noise ratio over the RGB channels, in dB. Infinite
+        // for identical images.
+        double Psnr;
+        // Mean structural similarity of the luma over 8x8 blocks, in [-1, 1].
+        double Ssim;
+        // Sum of the squared RGB channel differences.
+        uint64_t SquaredError;
+        // Pixels where any RGB channel differs by more than the tolerance.
+        uint64_t DifferentPixels;
+    };
+
+    // Both images must have the same size. If `diff` is not null, it receives
+    // an amplified per-channel absolute difference for inspection.
+    Result Compare(const Image& actual, const Image& reference, uint8_t channelTolerance, Image* diff);
+
+    // Same as `Compare`, but with the per-pixel pass forced to the portable
+    // scalar code, so that tests can check the vectorized pass against it.
+    Result CompareScalar(const Image& actual, const Image& reference, uint8_t channelTolerance, Image* diff);
+}
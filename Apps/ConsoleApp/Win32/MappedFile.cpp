@@ -0,0 +1,84 @@
+#include "MappedFile.h"
+
+#include <Windows.h>
+
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    std::filesystem::path GetPendingPath(const std::filesystem::path& filePath)
+    {
+        auto pendingPath = filePath;
+        pendingPath.concat(".pending");
+        return pendingPath;
+    }
+}
+
+MappedFile::MappedFile(const std::filesystem::path& filePath)
+{
+    // Nothing maps the file now, so a replacement that was written while it
+    // was mapped can move into place.
+    std::error_code error{};
+    if (std::filesystem::exists(GetPendingPath(filePath), error))
+    {
+        std::filesystem::rename(GetPendingPath(filePath), filePath, error);
+    }
+
+    // Sharing delete access lets the file be renamed or replaced while mapped.
+    m_file.attach(CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+
+    LARGE_INTEGER size{};
+    winrt::check_bool(GetFileSizeEx(m_file.get(), &size));
+    if (size.QuadPart == 0)
+    {
+        throw std::runtime_error{"Cannot map an empty file: " + filePath.string()};
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    m_mapping.attach(CreateFileMappingW(m_file.get(), nullptr, PAGE_WRITECOPY, 0, 0, nullptr));
+    winrt::check_bool(static_cast<bool>(m_mapping));
+
+    m_data = MapViewOfFile(m_mapping.get(), FILE_MAP_COPY, 0, 0, 0);
+    winrt::check_bool(m_data != nullptr);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+    }
+}
+
+void WriteMappedFile(const std::filesystem::path& filePath, const std::function<void(std::ostream&)>& write)
+{
+    auto temporaryPath = filePath;
+    temporaryPath.concat(".tmp");
+
+    try
+    {
+        {
+            std::ofstream stream{temporaryPath, std::ios::binary};
+            write(stream);
+            if (!stream)
+            {
+                throw std::runtime_error{"Failed to write " + temporaryPath.string()};
+            }
+        }
+
+        std::error_code error{};
+        std::filesystem::rename(temporaryPath, filePath, error);
+        if (error)
+        {
+            std::filesystem::rename(temporaryPath, GetPendingPath(filePath));
+        }
+    }
+    catch (...)
+    {
+        std::error_code error{};
+        std::filesystem::remove(temporaryPath, error);
+        throw;
+    }
+}
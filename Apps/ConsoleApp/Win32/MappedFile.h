@@ -0,0 +1,44 @@
+#pragma once
+
+#include <winrt/base.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+
+// A read-only view of a whole file mapped into memory. Pages are loaded on
+// first access, and writes to the view are private copies that never reach
+// the file. Opening a file first swaps in a replacement that `WriteMappedFile`
+// could not move into place.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& filePath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void* Data() const
+    {
+        return m_data;
+    }
+
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+private:
+    winrt::file_handle m_file{};
+    winrt::handle m_mapping{};
+    void* m_data{};
+    size_t m_size{};
+};
+
+// Writes a file that a `MappedFile` may have mapped. `write` fills a temporary
+// file, which then replaces `filePath`, so an interrupted or failed write
+// never leaves a truncated file behind. If `filePath` is mapped and cannot be
+// replaced, the new file is kept next to it until it is next opened.
+void WriteMappedFile(const std::filesystem::path& filePath, const std::function<void(std::ostream&)>& write);
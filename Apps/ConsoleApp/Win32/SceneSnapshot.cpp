@@ -0,0 +1,109 @@
+#include "SceneSnapshot.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    constexpr std::array<char, 4> MAGIC{'B', 'N', 'S', 'S'};
+
+    struct Header
+    {
+        std::array<char, 4> Magic;
+        uint32_t Version;
+        uint32_t BufferCount;
+        uint32_t SourceSize;
+        uint32_t DescriptionSize;
+    };
+
+    struct Entry
+    {
+        uint64_t Offset;
+        uint64_t Size;
+    };
+
+    size_t Align(size_t offset)
+    {
+        return (offset + SceneSnapshot::BUFFER_ALIGNMENT - 1) / SceneSnapshot::BUFFER_ALIGNMENT * SceneSnapshot::BUFFER_ALIGNMENT;
+    }
+}
+
+void SceneSnapshot::Write(const std::filesystem::path& filePath, std::string_view source, std::string_view description, const std::vector<Buffer>& buffers)
+{
+    const Header header{MAGIC, VERSION, static_cast<uint32_t>(buffers.size()), static_cast<uint32_t>(source.size()), static_cast<uint32_t>(description.size())};
+
+    const size_t headerSize = sizeof(Header) + sizeof(Entry) * buffers.size() + source.size() + description.size();
+
+    std::vector<Entry> entries{};
+    entries.reserve(buffers.size());
+    size_t offset = headerSize;
+    for (const auto& buffer : buffers)
+    {
+        offset = Align(offset);
+        entries.push_back({offset, buffer.Size});
+        offset += buffer.Size;
+    }
+
+    WriteMappedFile(filePath, [&](std::ostream& stream) {
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(entries.data()), sizeof(Entry) * entries.size());
+        stream.write(source.data(), source.size());
+        stream.write(description.data(), description.size());
+
+        constexpr std::array<char, BUFFER_ALIGNMENT> padding{};
+        size_t position = headerSize;
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            stream.write(padding.data(), entries[i].Offset - position);
+            stream.write(static_cast<const char*>(buffers[i].Data), buffers[i].Size);
+            position = entries[i].Offset + entries[i].Size;
+        }
+    });
+}
+
+SceneSnapshot::Reader::Reader(const std::filesystem::path& filePath)
+    : m_file{filePath}
+{
+    auto* const data = static_cast<uint8_t*>(m_file.Data());
+    const size_t size = m_file.Size();
+
+    Header header{};
+    if (size < sizeof(Header))
+    {
+        throw std::runtime_error{"Snapshot is truncated"};
+    }
+    std::memcpy(&header, data, sizeof(Header));
+
+    if (header.Magic != MAGIC)
+    {
+        throw std::runtime_error{"Not a scene snapshot"};
+    }
+
+    if (header.Version != VERSION)
+    {
+        throw std::runtime_error{"Unsupported snapshot version " + std::to_string(header.Version)};
+    }
+
+    const size_t sourceOffset = sizeof(Header) + sizeof(Entry) * size_t{header.BufferCount};
+    const size_t descriptionOffset = sourceOffset + header.SourceSize;
+    if (descriptionOffset + header.DescriptionSize > size)
+    {
+        throw std::runtime_error{"Snapshot is truncated"};
+    }
+    m_source = {reinterpret_cast<const char*>(data + sourceOffset), header.SourceSize};
+    m_description = {reinterpret_cast<const char*>(data + descriptionOffset), header.DescriptionSize};
+
+    m_buffers.reserve(header.BufferCount);
+    for (uint32_t i = 0; i < header.BufferCount; i++)
+    {
+        Entry entry{};
+        std::memcpy(&entry, data + sizeof(Header) + sizeof(Entry) * i, sizeof(Entry));
+        if (entry.Offset % BUFFER_ALIGNMENT != 0 || entry.Offset > size || entry.Size > size - entry.Offset)
+        {
+            throw std::runtime_error{"Snapshot buffer " + std::to_string(i) + " is out of bounds"};
+        }
+        m_buffers.push_back({data + entry.Offset, static_cast<size_t>(entry.Size)});
+    }
+}
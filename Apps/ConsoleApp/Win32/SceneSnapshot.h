@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+// A versioned binary file holding a processed scene: the URL it was loaded
+// from, a JSON description and the binary buffers it refers to by index.
+// Buffers are aligned so that JavaScript typed arrays can view the mapped file
+// in place.
+//
+// Layout, little endian:
+//   "BNSS", uint32 version, uint32 buffer count, uint32 source size,
+//   uint32 description size
+//   uint64 offset, uint64 size for each buffer
+//   UTF-8 source, UTF-8 description
+//   buffers, each starting at a multiple of BUFFER_ALIGNMENT
+namespace SceneSnapshot
+{
+    // Covers both this layout and the description written by index.js, so
+    // bump it when either changes.
+    constexpr uint32_t VERSION = 2;
+    constexpr size_t BUFFER_ALIGNMENT = 16;
+
+    struct Buffer
+    {
+        void* Data;
+        size_t Size;
+    };
+
+    // Writes the snapshot with `WriteMappedFile`, since the snapshot it
+    // replaces may still be mapped by JavaScript buffers awaiting collection.
+    void Write(const std::filesystem::path& filePath, std::string_view source, std::string_view description, const std::vector<Buffer>& buffers);
+
+    // Maps a snapshot written by `Write`. Throws `std::runtime_error` if the
+    // file is not a valid snapshot of this version.
+    class Reader
+    {
+    public:
+        explicit Reader(const std::filesystem::path& filePath);
+
+        std::string_view Source() const
+        {
+            return m_source;
+        }
+
+        std::string_view Description() const
+        {
+            return m_description;
+        }
+
+        const std::vector<Buffer>& Buffers() const
+        {
+            return m_buffers;
+        }
+
+    private:
+        MappedFile m_file;
+        std::string_view m_source{};
+        std::string_view m_description{};
+        std::vector<Buffer> m_buffers{};
+    };
+}
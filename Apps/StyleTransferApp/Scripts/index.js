@@ -5,10 +5,30 @@ let engine = null;
 let scene = null;
 let outputTexture = null;
 
+const DEFAULT_SCENE_URL = "https://raw.githubusercontent.com/KhronosGroup/glTF-Sample-Models/master/2.0/FlightHelmet/glTF/FlightHelmet.gltf";
+
+// Meshes with fewer indices than this are cheap enough at full detail.
+const LOD_MIN_INDICES = 3000;
+
+// Simplified levels of detail, picked by the fraction of the screen the mesh
+// covers.
+const LOD_LEVELS = [
+    { quality: 0.5, distance: 0.1 },
+    { quality: 0.15, distance: 0.02 },
+];
+
+// Number of frames between render statistics in the debug output.
+const STATS_INTERVAL = 600;
+
+// Milliseconds per frame when stepping time by a fixed amount, the same as
+// Babylon.js uses for `useConstantAnimationDeltaTime`.
+const FIXED_TIMESTEP = 16;
+
 /**
- * Sets up the engine, scene, and output texture.
+ * Sets up the engine, scene, and output texture. Returns a promise that
+ * resolves once the scene is loaded and prepared.
  */
-function startup(nativeTexture, width, height) {
+function startup(nativeTexture, width, height, sceneUrl, optimizeScene, fixedTimestep) {
     // Create a new native engine.
     engine = new BABYLON.NativeEngine();
 
@@ -44,9 +64,129 @@ function startup(nativeTexture, width, height) {
     camera.outputRenderTarget = outputTexture;
     camera.attachControl();
 
-    BABYLON.SceneLoader.AppendAsync("https://raw.githubusercontent.com/KhronosGroup/glTF-Sample-Models/master/2.0/FlightHelmet/glTF/FlightHelmet.gltf");
+    // Animations and anything scaled by the engine's delta time then advance
+    // by the same amount every frame instead of by the wall clock.
+    if (fixedTimestep) {
+        scene.useConstantAnimationDeltaTime = true;
+        engine.getDeltaTime = () => FIXED_TIMESTEP;
+    }
+
+    // Input is recorded and replayed once the scene is loaded and prepared,
+    // so that replays render the same meshes as the recording.
+    const sceneLoaded = BABYLON.SceneLoader.AppendAsync(sceneUrl || DEFAULT_SCENE_URL).then(() => {
+        if (optimizeScene) {
+            return prepareSceneAsync(scene);
+        }
+    });
+
+    logRenderStats(scene);
 
     engine.runRenderLoop(function () {
         scene.render();
     });
-}
\ No newline at end of file
+
+    return sceneLoaded;
+}
+
+/**
+ * Reduces the draw calls and vertices of the loaded scene.
+ */
+async function prepareSceneAsync(scene) {
+    const meshCount = scene.meshes.length;
+    const mergedCount = mergeStaticMeshes(scene);
+    const lodCount = await generateLodsAsync(scene);
+    console.log(`Merged ${mergedCount} of ${meshCount} meshes, added LODs to ${lodCount} meshes`);
+}
+
+/**
+ * Merges the static meshes that share a material into one mesh per material so
+ * that each material renders with a single draw call. Returns the number of
+ * meshes that were merged.
+ */
+function mergeStaticMeshes(scene) {
+    const animatedNodes = new Set();
+    for (const animationGroup of scene.animationGroups) {
+        for (const targetedAnimation of animationGroup.targetedAnimations) {
+            animatedNodes.add(targetedAnimation.target);
+        }
+    }
+
+    const isStatic = (mesh) => {
+        if (mesh.skeleton || mesh.morphTargetManager || mesh.hasInstances) {
+            return false;
+        }
+
+        for (let node = mesh; node; node = node.parent) {
+            if (animatedNodes.has(node) || node.animations.length > 0) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    // Meshes can only be merged if they also have the same vertex attributes.
+    // Merging disposes the source meshes along with their children, so meshes
+    // with children are left as they are.
+    const batches = new Map();
+    for (const mesh of scene.meshes) {
+        if (!(mesh instanceof BABYLON.Mesh) || !mesh.material || mesh.material instanceof BABYLON.MultiMaterial || mesh.getTotalVertices() === 0 || mesh.getChildren().length > 0 || !isStatic(mesh)) {
+            continue;
+        }
+
+        const key = `${mesh.material.uniqueId}:${mesh.getVerticesDataKinds().sort().join(",")}`;
+        if (!batches.has(key)) {
+            batches.set(key, []);
+        }
+        batches.get(key).push(mesh);
+    }
+
+    let mergedCount = 0;
+    for (const meshes of batches.values()) {
+        if (meshes.length > 1 && BABYLON.Mesh.MergeMeshes(meshes, true, true)) {
+            mergedCount += meshes.length;
+        }
+    }
+
+    return mergedCount;
+}
+
+/**
+ * Adds simplified levels of detail to the meshes with the most geometry. The
+ * simplification runs asynchronously while the scene keeps rendering at full
+ * detail. Returns the number of meshes that got levels of detail.
+ */
+async function generateLodsAsync(scene) {
+    const meshes = scene.meshes.filter(
+        (mesh) => mesh instanceof BABYLON.Mesh && !mesh.skeleton && !mesh.morphTargetManager && mesh.getTotalIndices() >= LOD_MIN_INDICES && mesh.getLODLevels().length === 0
+    );
+
+    await Promise.all(
+        meshes.map(
+            (mesh) =>
+                new Promise((resolve) => {
+                    mesh.useLODScreenCoverage = true;
+                    mesh.simplify(LOD_LEVELS, true, BABYLON.SimplificationType.QUADRATIC, resolve);
+                })
+        )
+    );
+
+    return meshes.length;
+}
+
+/**
+ * Periodically logs the draw calls and frame time to the debug output, and
+ * reports the draw calls of every frame to the host with `setFrameDrawCalls`.
+ */
+function logRenderStats(scene) {
+    const instrumentation = new BABYLON.SceneInstrumentation(scene);
+    instrumentation.captureFrameTime = true;
+
+    let frameCount = 0;
+    scene.onAfterRenderObservable.add(() => {
+        setFrameDrawCalls(instrumentation.drawCallsCounter.current);
+        if (++frameCount % STATS_INTERVAL === 0) {
+            console.log(`Draw calls: ${instrumentation.drawCallsCounter.current}, frame time: ${instrumentation.frameTimeCounter.lastSecAverage.toFixed(2)} ms`);
+        }
+    });
+}
@@ -24,15 +24,32 @@
 
 #include <PathCch.h>
 #include <Windows.h>
+#include <Psapi.h>
 #include <Windowsx.h>
 #include <Shlwapi.h>
+#include <shellapi.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
 #include <stdio.h>
+#include <string>
+#include <thread>
 #include <wrl.h>
+#include <d3d11_4.h>
 #include <dxgi1_2.h>
 #include <filesystem>
 
 #include "resource.h"
+#include "InputBuffer.h"
+#include "InputRecording.h"
+#include "ModelManager.h"
 
 using namespace winrt::Windows::AI::MachineLearning;
 using namespace winrt::Windows::Foundation::Collections;
@@ -54,15 +71,33 @@ namespace
     // Global variables
     constexpr const uint32_t WIDTH = 720;
     constexpr const uint32_t HEIGHT = 720;
+    constexpr const uint64_t FRAME_BYTES = uint64_t{WIDTH} * HEIGHT * 4;
 
-    const std::vector<winrt::hstring> g_models = {
-        L"\\Models\\candy.onnx",
-        L"\\Models\\la_muse.onnx",
-        L"\\Models\\mosaic.onnx",
-        L"\\Models\\udnie.onnx"};
+    // Every *.onnx file in the Models folder next to the executable, sorted
+    // by name.
+    std::vector<winrt::hstring> g_models{};
 
     int g_selectedModel = 0;
 
+    // Set with `--resident-models <count>`. Keeping two resident lets the
+    // next style pre-warm while the current one runs.
+    size_t g_maxResidentModels = 2;
+
+    // Set with `--scene <url>` to load another glTF asset, and with
+    // `--optimize-scene 0` to render it without batching and LODs.
+    std::string g_sceneUrl{};
+    bool g_optimizeScene{true};
+
+    // Set with `--self-test <iterations>` to check the style models on a test
+    // pattern instead of opening the window.
+    uint32_t g_selfTestIterations = 0;
+
+    // The largest difference in any channel allowed between the outputs of
+    // the shared textures and of WinML's own surfaces.
+    constexpr int SELF_TEST_TOLERANCE = 1;
+
+    const auto g_startTime = std::chrono::steady_clock::now();
+
     // Global Variables:
     HINSTANCE hInst;                     // current instance
     WCHAR szTitle[MAX_LOADSTRING];       // The title bar text
@@ -71,9 +106,101 @@ namespace
     std::optional<Babylon::Graphics::Device> g_device{};
     std::optional<Babylon::Graphics::DeviceUpdate> g_update{};
     Babylon::Plugins::NativeInput* g_nativeInput{};
+    InputBuffer g_inputBuffer{};
+
+    // Events delivered early because the ring was full, recorded with the
+    // rest of the frame's input at the next frame boundary.
+    std::vector<InputBuffer::Event> g_overflowEvents{};
+    std::atomic<bool> g_sceneLoaded{false};
+    std::atomic<bool> g_sceneLoadFailed{false};
+
+    // Presses of the `R` key since the last frame boundary, applied there like
+    // the input so that the style is recorded for the frame that uses it.
+    int g_pendingModelChanges = 0;
+
+    // A replay gives up if the scene has not loaded by then, so that a broken
+    // scene cannot leave a hidden window running.
+    constexpr auto SCENE_LOAD_TIMEOUT = std::chrono::minutes{2};
+
+    int g_exitCode = 0;
+
+    // Set with `--record <file>` to log the input of an interactive session.
+    std::optional<InputRecording::Recorder> g_recorder{};
+
+    // Set with `--replay <file>` to drive the session from a recording.
+    struct Replay
+    {
+        std::filesystem::path FilePath;
+        std::vector<InputRecording::Frame> Frames;
+        size_t NextFrame;
+        std::vector<uint32_t> FrameTimes;
+        std::vector<uint64_t> FrameBytesCopied;
+        std::vector<uint32_t> FrameDrawCalls;
+    };
+    std::optional<Replay> g_replay{};
+
+    // Set with `--synthetic-input <frames>` to drive a hidden session with
+    // mouse moves pushed from another thread at `--synthetic-rate <events per
+    // second>`, and to report the input throughput and latency once that many
+    // frames have rendered.
+    uint32_t g_syntheticFrames = 0;
+    uint32_t g_syntheticRate = 8000;
+
+    struct SyntheticInput
+    {
+        std::thread Producer;
+        std::atomic<bool> Stop{false};
+        std::atomic<uint64_t> Pushed{0};
+        std::chrono::steady_clock::time_point Start;
+        uint64_t Received = 0;
+        uint64_t Delivered = 0;
+
+        // When the oldest input delivered for the frame being rendered was
+        // pushed, and the latency until each frame with input was presented.
+        std::optional<std::chrono::steady_clock::time_point> PendingPush;
+        std::vector<uint32_t> LatenciesMicroseconds;
+        uint32_t RenderedFrames = 0;
+    };
+    std::optional<SyntheticInput> g_synthetic{};
+
     std::optional<Babylon::AppRuntime> g_runtime{};
     bool g_minimized{false};
     winrt::com_ptr<ID3D11Texture2D> g_BabylonRenderTexture{};
+    winrt::com_ptr<ID3D11Texture2D> g_StyledTexture{};
+    winrt::com_ptr<ID3D11Texture2D> g_BackBufferTexture{};
+
+    // Bytes copied between textures since the last frame boundary.
+    uint64_t g_frameBytesCopied = 0;
+
+    // Draw calls of the last `scene.render`, set from the JavaScript thread.
+    std::atomic<uint32_t> g_frameDrawCalls{0};
+
+    void CopyTexture(ID3D11DeviceContext* context, ID3D11Texture2D* destination, ID3D11Texture2D* source)
+    {
+        context->CopyResource(destination, source);
+        g_frameBytesCopied += FRAME_BYTES;
+    }
+
+    // Creates a window-sized texture that WinML can open on its own D3D12
+    // device and use in place. WinML stages copies of textures that it cannot
+    // share, which is why the swap chain's buffers are never bound to a model.
+    winrt::com_ptr<ID3D11Texture2D> CreateSharedTexture(ID3D11Device* device)
+    {
+        D3D11_TEXTURE2D_DESC desc{};
+        desc.Width = WIDTH;
+        desc.Height = HEIGHT;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc = {1, 0};
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
+
+        winrt::com_ptr<ID3D11Texture2D> texture;
+        winrt::check_hresult(device->CreateTexture2D(&desc, nullptr, texture.put()));
+        return texture;
+    }
 
     std::filesystem::path GetModulePath()
     {
@@ -137,6 +264,10 @@ namespace
 
         g_d3dDevice->GetImmediateContext(g_d3dContext.put());
 
+        // Style models are warmed up on a background thread while the render
+        // loop uses the same immediate context.
+        g_d3dContext.as<ID3D11Multithread>()->SetMultithreadProtected(TRUE);
+
         DXGI_SWAP_CHAIN_DESC1 swapChainDesc{};
         swapChainDesc.Width = WIDTH; // use automatic sizing
         swapChainDesc.Height = HEIGHT;
@@ -163,7 +294,32 @@ namespace
         Microsoft::WRL::ComPtr<IDXGISurface1> dxgiBuffer;
         winrt::check_hresult(g_SwapChain->GetBuffer(0, __uuidof(IDXGISurface1), &dxgiBuffer));
 
-        winrt::check_hresult(dxgiBuffer->QueryInterface(__uuidof(ID3D11Texture2D), g_BabylonRenderTexture.put_void()));
+        winrt::check_hresult(dxgiBuffer->QueryInterface(__uuidof(ID3D11Texture2D), g_BackBufferTexture.put_void()));
+
+        // Babylon Native renders off screen into a texture that the style
+        // transfer model reads directly, and the model writes into another
+        // texture that is copied into the back buffer.
+        g_BabylonRenderTexture = CreateSharedTexture(g_d3dDevice.get());
+        g_StyledTexture = CreateSharedTexture(g_d3dDevice.get());
+    }
+
+    // Wraps a D3D11 texture in a video frame without copying it.
+    VideoFrame CreateVideoFrame(ID3D11Texture2D* texture)
+    {
+        winrt::com_ptr<IDXGISurface> dxgiSurface;
+        winrt::check_hresult(texture->QueryInterface(IID_PPV_ARGS(dxgiSurface.put())));
+
+        winrt::com_ptr<::IInspectable> surface;
+        winrt::check_hresult(CreateDirect3D11SurfaceFromDXGISurface(dxgiSurface.get(), surface.put()));
+
+        return VideoFrame::CreateWithDirect3D11Surface(surface.as<winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface>());
+    }
+
+    winrt::com_ptr<ID3D11Texture2D> GetTexture(const VideoFrame& frame)
+    {
+        winrt::com_ptr<ID3D11Texture2D> texture;
+        winrt::check_hresult(frame.Direct3DSurface().as<IDirect3DDxgiInterfaceAccess>()->GetInterface(IID_PPV_ARGS(texture.put())));
+        return texture;
     }
 
     // Creates Babylon Native Graphics Device.
@@ -185,78 +341,551 @@ namespace
         return modulePath;
     }
 
-    // Creates a learning model session from a onnx file.
-    LearningModelSession CreateModelSession(winrt::hstring modelLocalPath, LearningModelDevice device)
+    std::vector<winrt::hstring> FindModels()
     {
-        auto executablePath = GetInstalledLocation();
-        auto finalPath = executablePath + modelLocalPath;
-        auto model = LearningModel::LoadFromFilePath(finalPath.c_str());
-        return LearningModelSession(model, device);
+        std::vector<winrt::hstring> models{};
+        for (const auto& entry : std::filesystem::directory_iterator{std::filesystem::path{GetInstalledLocation().c_str()} / L"Models"})
+        {
+            if (entry.path().extension() == L".onnx")
+            {
+                models.emplace_back(entry.path().c_str());
+            }
+        }
+
+        std::sort(models.begin(), models.end());
+        return models;
     }
 
-    LearningModelBinding BindMLModel(LearningModelSession session)
+    // Logs the time since startup and the resident memory of the process.
+    void LogMetrics(const char* label, size_t residentModels)
     {
-        auto outputFrame = VideoFrame::CreateAsDirect3D11SurfaceBacked(DirectXPixelFormat::B8G8R8A8UIntNormalized, WIDTH, HEIGHT, session.Device().Direct3D11Device());
+        PROCESS_MEMORY_COUNTERS counters{};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
 
-        // now create a session and binding
-        auto binding = LearningModelBinding{session};
-        binding.Bind(L"outputImage", outputFrame);
-        return binding;
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - g_startTime);
+
+        char message[256];
+        sprintf_s(message, "%s: %lld ms since start, %zu MB working set, %zu of %zu models resident\n",
+            label, static_cast<long long>(elapsed.count()), counters.WorkingSetSize / (1024 * 1024), residentModels, g_models.size());
+        OutputDebugStringA(message);
     }
 
-    VideoFrame RunModel(LearningModelSession session, LearningModelBinding binding, VideoFrame inputFrame)
+    // The binding already refers to the input and output frames, so the
+    // model reads the Babylon Native render target and writes the styled
+    // texture in place.
+    void RunModel(LearningModelSession session, LearningModelBinding binding)
     {
-        // bind the input image
-        binding.Bind(L"inputImage", inputFrame);
+        session.Evaluate(binding, L"RunId");
+    }
+
+    // Queues pointer input for delivery at the next frame boundary.
+    void QueueInput(InputBuffer::EventType type, uint32_t id, int32_t x, int32_t y)
+    {
+        if (g_replay || g_synthetic)
+        {
+            // Live input would make the replay diverge from the recording,
+            // and synthetic input is already pushed from another thread.
+            return;
+        }
 
-        // Run model
-        auto results = session.Evaluate(binding, L"RunId");
-        VideoFrame evalOutput = results.Outputs().Lookup(L"outputImage").try_as<VideoFrame>();
-        return evalOutput;
+        if (!g_inputBuffer.Push({type, id, x, y}) && g_nativeInput != nullptr)
+        {
+            // The ring is full (e.g. while minimized), so deliver what is
+            // queued now rather than dropping input.
+            const auto& events = g_inputBuffer.Flush(*g_nativeInput);
+            if (g_recorder && g_sceneLoaded)
+            {
+                g_overflowEvents.insert(g_overflowEvents.end(), events.begin(), events.end());
+            }
+            g_inputBuffer.Push({type, id, x, y});
+        }
     }
 
-    void Uninitialize()
+    void ParseCommandLine()
     {
-        if (g_device)
+        int argc;
+        LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+        for (int i = 1; i + 1 < argc; i++)
         {
-            g_update->Finish();
-            g_device->FinishRenderingCurrentFrame();
+            if (wcscmp(argv[i], L"--record") == 0)
+            {
+                g_recorder.emplace(argv[++i]);
+            }
+            else if (wcscmp(argv[i], L"--replay") == 0)
+            {
+                std::filesystem::path filePath{argv[++i]};
+                g_replay.emplace(Replay{filePath, InputRecording::Load(filePath), 0, {}, {}, {}});
+            }
+            else if (wcscmp(argv[i], L"--resident-models") == 0)
+            {
+                g_maxResidentModels = std::wcstoul(argv[++i], nullptr, 10);
+            }
+            else if (wcscmp(argv[i], L"--scene") == 0)
+            {
+                g_sceneUrl = winrt::to_string(argv[++i]);
+            }
+            else if (wcscmp(argv[i], L"--optimize-scene") == 0)
+            {
+                g_optimizeScene = std::wcstoul(argv[++i], nullptr, 10) != 0;
+            }
+            else if (wcscmp(argv[i], L"--self-test") == 0)
+            {
+                g_selfTestIterations = std::wcstoul(argv[++i], nullptr, 10);
+            }
+            else if (wcscmp(argv[i], L"--synthetic-input") == 0)
+            {
+                g_syntheticFrames = std::wcstoul(argv[++i], nullptr, 10);
+            }
+            else if (wcscmp(argv[i], L"--synthetic-rate") == 0)
+            {
+                g_syntheticRate = std::max(std::wcstoul(argv[++i], nullptr, 10), 1ul);
+            }
         }
+        LocalFree(argv);
+    }
 
-        g_nativeInput = {};
-        g_runtime.reset();
-        g_update.reset();
-        g_device.reset();
+    enum class FrameInputResult
+    {
+        Continue,
+        ReplayFinished,
+        ReplayFailed,
+    };
+
+    int NextModel(int model)
+    {
+        return model + 1 < static_cast<int>(g_models.size()) ? (model + 1) : -1;
     }
 
-    void CopyTo(VideoFrame src, VideoFrame dst, winrt::com_ptr<ID3D11DeviceContext> d3d11Context)
+    // Writes a test report to the debug output and to standard output, where
+    // ctest shows it.
+    void LogReport(const char* message)
     {
-        auto srcD3DSurface = src.Direct3DSurface().as<IDirect3DDxgiInterfaceAccess>();
-        auto dstD3DSurface = dst.Direct3DSurface().as<IDirect3DDxgiInterfaceAccess>();
+        OutputDebugStringA(message);
+        std::fputs(message, stdout);
+        std::fflush(stdout);
+    }
 
-        winrt::com_ptr<ID3D11Texture2D> srcTexture;
-        winrt::check_hresult(srcD3DSurface->GetInterface(IID_PPV_ARGS(&srcTexture)));
+    // Drags the mouse around a circle in the middle of the window, which
+    // orbits the camera, pushing moves at `g_syntheticRate` until stopped.
+    void ProduceSyntheticInput(SyntheticInput& input)
+    {
+        auto push = [&input](const InputBuffer::Event& event) {
+            // Only the render loop may flush, so wait for it to drain the ring.
+            while (!g_inputBuffer.Push(event))
+            {
+                if (input.Stop)
+                {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+            input.Pushed++;
+        };
+
+        constexpr int32_t RADIUS = static_cast<int32_t>(WIDTH / 4);
+        auto position = [](uint64_t i, int32_t& x, int32_t& y) {
+            const double angle = i * 0.001;
+            x = static_cast<int32_t>(WIDTH / 2 + RADIUS * std::cos(angle));
+            y = static_cast<int32_t>(HEIGHT / 2 + RADIUS * std::sin(angle));
+        };
+
+        int32_t x, y;
+        position(0, x, y);
+        push({InputBuffer::EventType::MouseDown, Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y});
+
+        const auto start = std::chrono::steady_clock::now();
+        uint64_t i = 1;
+        while (!input.Stop)
+        {
+            // Pushes are scheduled from the start rather than from the
+            // previous push, so a late wake-up sends a burst to catch up.
+            const auto due = start + std::chrono::nanoseconds{static_cast<int64_t>(i * 1'000'000'000 / g_syntheticRate)};
+            const auto now = std::chrono::steady_clock::now();
+            if (now < due)
+            {
+                if (due - now > std::chrono::milliseconds{2})
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
 
-        winrt::com_ptr<ID3D11Texture2D> dstTexture;
-        winrt::check_hresult(dstD3DSurface->GetInterface(IID_PPV_ARGS(&dstTexture)));
+            position(i++, x, y);
+            push({InputBuffer::EventType::MouseMove, 0, x, y});
+        }
 
-        d3d11Context->CopyResource(dstTexture.get(), srcTexture.get());
+        push({InputBuffer::EventType::MouseUp, Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y});
     }
 
-    void CopyTo(ID3D11Texture2D* src, VideoFrame dst, winrt::com_ptr<ID3D11DeviceContext> d3d11Context)
+    // Stops the producer, delivers what it left in the ring and reports the
+    // input throughput and latency. Returns 1 if any pushed event was not
+    // received, or if the producer could not keep up with `g_syntheticRate`.
+    int FinishSyntheticInput()
     {
-        winrt::com_ptr<ID3D11Texture2D> dstTexture;
-        winrt::check_hresult(dst.Direct3DSurface().as<IDirect3DDxgiInterfaceAccess>()->GetInterface(IID_PPV_ARGS(&dstTexture)));
+        auto& input = *g_synthetic;
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - input.Start;
+        const double eventsPerSecond = input.Pushed / elapsed.count();
+
+        input.Stop = true;
+        input.Producer.join();
+
+        const auto& events = g_inputBuffer.Flush(*g_nativeInput);
+        input.Received += g_inputBuffer.LastFlush().Received;
+        input.Delivered += events.size();
+
+        auto& latencies = input.LatenciesMicroseconds;
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t totalLatency = 0;
+        for (auto latency : latencies)
+        {
+            totalLatency += latency;
+        }
+
+        char message[512];
+        sprintf_s(message, "Synthetic input over %u frames: %.0f events/s pushed, %llu events received, %llu delivered after coalescing, input-to-render latency mean %.3f ms, p99 %.3f ms\n",
+            input.RenderedFrames, eventsPerSecond,
+            static_cast<unsigned long long>(input.Received), static_cast<unsigned long long>(input.Delivered),
+            latencies.empty() ? 0.0 : totalLatency / 1000.0 / latencies.size(),
+            latencies.empty() ? 0.0 : latencies[latencies.size() * 99 / 100] / 1000.0);
+        LogReport(message);
+
+        if (input.Received != input.Pushed)
+        {
+            sprintf_s(message, "FAIL: %llu events pushed but %llu received\n",
+                static_cast<unsigned long long>(input.Pushed.load()), static_cast<unsigned long long>(input.Received));
+            LogReport(message);
+            return 1;
+        }
+
+        if (eventsPerSecond < g_syntheticRate * 0.9)
+        {
+            sprintf_s(message, "FAIL: the input path did not keep up with %u events/s\n", g_syntheticRate);
+            LogReport(message);
+            return 1;
+        }
 
-        d3d11Context->CopyResource(dstTexture.get(), src);
+        return 0;
     }
 
-    void CopyTo(VideoFrame src, ID3D11Texture2D* dst, winrt::com_ptr<ID3D11DeviceContext> d3d11Context)
+    // Whether a replay should stop waiting for the scene.
+    bool SceneLoadFailed()
     {
-        winrt::com_ptr<ID3D11Texture2D> srcTexture;
-        winrt::check_hresult(src.Direct3DSurface().as<IDirect3DDxgiInterfaceAccess>()->GetInterface(IID_PPV_ARGS(&srcTexture)));
+        if (g_sceneLoadFailed || std::chrono::steady_clock::now() - g_startTime > SCENE_LOAD_TIMEOUT)
+        {
+            OutputDebugStringA("Replay failed: the scene did not load\n");
+            return true;
+        }
 
-        d3d11Context->CopyResource(dst, srcTexture.get());
+        return false;
+    }
+
+    // Delivers the input and style for the frame about to start, either from
+    // the live input buffer or from the replay, and records them if requested.
+    // `presentTime` is when the frame that just ended was presented.
+    FrameInputResult ProcessFrameInput(uint32_t frameMicroseconds, uint64_t frameBytesCopied, uint32_t frameDrawCalls, std::chrono::steady_clock::time_point presentTime)
+    {
+        if ((g_replay || g_synthetic) && !g_sceneLoaded)
+        {
+            return SceneLoadFailed() ? FrameInputResult::ReplayFailed : FrameInputResult::Continue;
+        }
+
+        if (g_replay)
+        {
+            if (g_replay->NextFrame > 0)
+            {
+                g_replay->FrameTimes.push_back(frameMicroseconds);
+                g_replay->FrameBytesCopied.push_back(frameBytesCopied);
+                g_replay->FrameDrawCalls.push_back(frameDrawCalls);
+            }
+
+            if (g_replay->NextFrame == g_replay->Frames.size())
+            {
+                return FrameInputResult::ReplayFinished;
+            }
+
+            const auto& frame = g_replay->Frames[g_replay->NextFrame++];
+            g_selectedModel = frame.SelectedModel;
+            for (const auto& event : frame.Events)
+            {
+                InputBuffer::Send(*g_nativeInput, event);
+            }
+
+            return FrameInputResult::Continue;
+        }
+
+        if (g_synthetic)
+        {
+            auto& input = *g_synthetic;
+            if (!input.Producer.joinable())
+            {
+                input.Start = std::chrono::steady_clock::now();
+                input.Producer = std::thread{ProduceSyntheticInput, std::ref(input)};
+            }
+            else
+            {
+                if (input.PendingPush)
+                {
+                    input.LatenciesMicroseconds.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(presentTime - *input.PendingPush).count()));
+                }
+
+                if (++input.RenderedFrames == g_syntheticFrames)
+                {
+                    return FrameInputResult::ReplayFinished;
+                }
+            }
+
+            const auto& events = g_inputBuffer.Flush(*g_nativeInput);
+            const auto& flush = g_inputBuffer.LastFlush();
+            input.Received += flush.Received;
+            input.Delivered += events.size();
+            input.PendingPush = flush.Received > 0 ? std::make_optional(flush.OldestPush) : std::nullopt;
+
+            return FrameInputResult::Continue;
+        }
+
+        for (; g_pendingModelChanges > 0; g_pendingModelChanges--)
+        {
+            g_selectedModel = NextModel(g_selectedModel);
+        }
+
+        const auto& events = g_inputBuffer.Flush(*g_nativeInput);
+        if (g_recorder && g_sceneLoaded)
+        {
+            if (g_overflowEvents.empty())
+            {
+                g_recorder->RecordFrame(frameMicroseconds, g_selectedModel, events);
+            }
+            else
+            {
+                g_overflowEvents.insert(g_overflowEvents.end(), events.begin(), events.end());
+                g_recorder->RecordFrame(frameMicroseconds, g_selectedModel, g_overflowEvents);
+                g_overflowEvents.clear();
+            }
+        }
+
+        return FrameInputResult::Continue;
+    }
+
+    // Writes the per-frame timings of a replay next to the recording.
+    void WriteReplayTimings()
+    {
+        auto filePath = g_replay->FilePath;
+        filePath.concat(".timings.csv");
+
+        std::ofstream stream{filePath};
+        stream << "frame,microseconds,model,bytes_copied,draw_calls\n";
+
+        uint64_t total = 0;
+        uint64_t totalBytesCopied = 0;
+        uint64_t totalDrawCalls = 0;
+        for (size_t i = 0; i < g_replay->FrameTimes.size(); i++)
+        {
+            stream << i << ',' << g_replay->FrameTimes[i] << ',' << g_replay->Frames[i].SelectedModel << ',' << g_replay->FrameBytesCopied[i] << ',' << g_replay->FrameDrawCalls[i] << '\n';
+            total += g_replay->FrameTimes[i];
+            totalBytesCopied += g_replay->FrameBytesCopied[i];
+            totalDrawCalls += g_replay->FrameDrawCalls[i];
+        }
+
+        const size_t frames = g_replay->FrameTimes.size();
+        char message[256];
+        sprintf_s(message, "Replayed %zu frames, average frame time %.3f ms, %llu bytes copied per frame, %.1f draw calls per frame\n",
+            frames, frames == 0 ? 0.0 : total / 1000.0 / frames, static_cast<unsigned long long>(frames == 0 ? 0 : totalBytesCopied / frames),
+            frames == 0 ? 0.0 : static_cast<double>(totalDrawCalls) / frames);
+        OutputDebugStringA(message);
+    }
+
+    // A gradient under a checkerboard, so that every style produces detail.
+    std::vector<uint8_t> CreateTestPattern()
+    {
+        std::vector<uint8_t> pixels(FRAME_BYTES);
+        for (uint32_t y = 0; y < HEIGHT; y++)
+        {
+            for (uint32_t x = 0; x < WIDTH; x++)
+            {
+                auto* pixel = &pixels[(size_t{y} * WIDTH + x) * 4];
+                pixel[0] = static_cast<uint8_t>(x * 255 / (WIDTH - 1));
+                pixel[1] = static_cast<uint8_t>(y * 255 / (HEIGHT - 1));
+                pixel[2] = (x / 40 + y / 40) % 2 == 0 ? 255 : 0;
+                pixel[3] = 255;
+            }
+        }
+
+        return pixels;
+    }
+
+    std::vector<uint8_t> ReadTexture(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Texture2D* texture)
+    {
+        D3D11_TEXTURE2D_DESC desc{};
+        texture->GetDesc(&desc);
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.BindFlags = 0;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        desc.MiscFlags = 0;
+
+        winrt::com_ptr<ID3D11Texture2D> staging;
+        winrt::check_hresult(device->CreateTexture2D(&desc, nullptr, staging.put()));
+        context->CopyResource(staging.get(), texture);
+
+        D3D11_MAPPED_SUBRESOURCE mapped{};
+        winrt::check_hresult(context->Map(staging.get(), 0, D3D11_MAP_READ, 0, &mapped));
+
+        std::vector<uint8_t> pixels(size_t{desc.Width} * desc.Height * 4);
+        for (uint32_t y = 0; y < desc.Height; y++)
+        {
+            std::memcpy(&pixels[size_t{y} * desc.Width * 4], static_cast<const uint8_t*>(mapped.pData) + size_t{y} * mapped.RowPitch, size_t{desc.Width} * 4);
+        }
+
+        context->Unmap(staging.get(), 0);
+        return pixels;
+    }
+
+    void WaitForGpu(ID3D11Device* device, ID3D11DeviceContext* context)
+    {
+        D3D11_QUERY_DESC desc{D3D11_QUERY_EVENT, 0};
+        winrt::com_ptr<ID3D11Query> query;
+        winrt::check_hresult(device->CreateQuery(&desc, query.put()));
+        context->End(query.get());
+
+        BOOL done = FALSE;
+        HRESULT result;
+        while ((result = context->GetData(query.get(), &done, sizeof(done), 0)) == S_FALSE)
+        {
+            SwitchToThread();
+        }
+        winrt::check_hresult(result);
+    }
+
+    struct FrameCost
+    {
+        double Milliseconds;
+        uint64_t BytesCopied;
+    };
+
+    // Runs `frame` once to warm up and then `g_selfTestIterations` times, and
+    // returns the average time and bytes copied per frame.
+    FrameCost MeasureFrames(ID3D11Device* device, ID3D11DeviceContext* context, const std::function<void()>& frame)
+    {
+        frame();
+        WaitForGpu(device, context);
+
+        g_frameBytesCopied = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < g_selfTestIterations; i++)
+        {
+            frame();
+        }
+        WaitForGpu(device, context);
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        return {elapsed.count() / g_selfTestIterations, g_frameBytesCopied / g_selfTestIterations};
+    }
+
+    // Evaluates every style model on a test pattern through the shared
+    // textures that the render loop binds, and as a reference through WinML's
+    // own surfaces with a copy in and out, as before the textures were shared.
+    // Logs the time and bytes copied per frame of both, and fails if their
+    // outputs differ by more than SELF_TEST_TOLERANCE in any channel.
+    int RunSelfTest(LearningModelDevice learnDevice)
+    {
+        winrt::com_ptr<ID3D11Device> device;
+        winrt::check_hresult(learnDevice.Direct3D11Device().as<IDirect3DDxgiInterfaceAccess>()->GetInterface(IID_PPV_ARGS(device.put())));
+
+        winrt::com_ptr<ID3D11DeviceContext> context;
+        device->GetImmediateContext(context.put());
+
+        auto renderTexture = CreateSharedTexture(device.get());
+        auto styledTexture = CreateSharedTexture(device.get());
+
+        // Stands in for the back buffer, which only takes part in copies.
+        auto presentTexture = CreateSharedTexture(device.get());
+
+        const auto pattern = CreateTestPattern();
+        context->UpdateSubresource(renderTexture.get(), 0, nullptr, pattern.data(), WIDTH * 4, 0);
+
+        const VideoFrame renderFrame = CreateVideoFrame(renderTexture.get());
+        const VideoFrame styledFrame = CreateVideoFrame(styledTexture.get());
+
+        const auto referenceInput = VideoFrame::CreateAsDirect3D11SurfaceBacked(DirectXPixelFormat::B8G8R8A8UIntNormalized, WIDTH, HEIGHT, learnDevice.Direct3D11Device());
+        const auto referenceOutput = VideoFrame::CreateAsDirect3D11SurfaceBacked(DirectXPixelFormat::B8G8R8A8UIntNormalized, WIDTH, HEIGHT, learnDevice.Direct3D11Device());
+        auto referenceInputTexture = GetTexture(referenceInput);
+        auto referenceOutputTexture = GetTexture(referenceOutput);
+
+        if (g_models.empty())
+        {
+            LogReport("FAIL: no style models found\n");
+            return 1;
+        }
+
+        bool passed = true;
+        for (const auto& modelPath : g_models)
+        {
+            LearningModelSession session{LearningModel::LoadFromFilePath(modelPath), learnDevice};
+
+            LearningModelBinding binding{session};
+            binding.Bind(L"inputImage", renderFrame);
+            binding.Bind(L"outputImage", styledFrame);
+
+            LearningModelBinding referenceBinding{session};
+            referenceBinding.Bind(L"inputImage", referenceInput);
+            referenceBinding.Bind(L"outputImage", referenceOutput);
+
+            const auto shared = MeasureFrames(device.get(), context.get(), [&]() {
+                RunModel(session, binding);
+                CopyTexture(context.get(), presentTexture.get(), styledTexture.get());
+            });
+
+            const auto reference = MeasureFrames(device.get(), context.get(), [&]() {
+                CopyTexture(context.get(), referenceInputTexture.get(), renderTexture.get());
+                RunModel(session, referenceBinding);
+                CopyTexture(context.get(), presentTexture.get(), referenceOutputTexture.get());
+            });
+
+            const auto styled = ReadTexture(device.get(), context.get(), styledTexture.get());
+            const auto expected = ReadTexture(device.get(), context.get(), referenceOutputTexture.get());
+
+            int maxDifference = 0;
+            for (size_t i = 0; i < styled.size(); i++)
+            {
+                maxDifference = std::max(maxDifference, std::abs(int{styled[i]} - int{expected[i]}));
+            }
+
+            const bool matches = maxDifference <= SELF_TEST_TOLERANCE;
+            passed = passed && matches;
+
+            char message[512];
+            sprintf_s(message, "%s %s: shared textures %.3f ms and %llu bytes copied per frame, WinML surfaces %.3f ms and %llu bytes copied per frame, max channel difference %d\n",
+                matches ? "PASS" : "FAIL", std::filesystem::path{modelPath.c_str()}.filename().string().c_str(),
+                shared.Milliseconds, static_cast<unsigned long long>(shared.BytesCopied),
+                reference.Milliseconds, static_cast<unsigned long long>(reference.BytesCopied),
+                maxDifference);
+            LogReport(message);
+        }
+
+        return passed ? 0 : 1;
+    }
+
+    void Uninitialize()
+    {
+        if (g_synthetic && g_synthetic->Producer.joinable())
+        {
+            g_synthetic->Stop = true;
+            g_synthetic->Producer.join();
+        }
+
+        if (g_device)
+        {
+            g_update->Finish();
+            g_device->FinishRenderingCurrentFrame();
+        }
+
+        g_nativeInput = {};
+        g_runtime.reset();
+        g_update.reset();
+        g_device.reset();
     }
 }
 
@@ -270,19 +899,38 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     UNREFERENCED_PARAMETER(hPrevInstance);
     UNREFERENCED_PARAMETER(lpCmdLine);
 
+    try
+    {
+        ParseCommandLine();
+    }
+    catch (const std::exception& exception)
+    {
+        // A recording that cannot be created or read.
+        LogReport((std::string{exception.what()} + "\n").c_str());
+        return 1;
+    }
+
+    if (g_syntheticFrames > 0)
+    {
+        g_synthetic.emplace();
+    }
+
     //------------- WinML intialization ------------------
 
-    std::vector<LearningModelSession> MLSessions{};
-    std::vector<LearningModelBinding> MLBindings{};
     LearningModelDevice learnDevice = LearningModelDevice(LearningModelDeviceKind::DirectXHighPerformance);
-    VideoFrame inputFrame = VideoFrame::CreateAsDirect3D11SurfaceBacked(DirectXPixelFormat::B8G8R8A8UIntNormalized, WIDTH, HEIGHT, learnDevice.Direct3D11Device());
 
-    for (size_t i = 0; i < g_models.size(); i++)
+    if (g_selfTestIterations > 0)
     {
-        LearningModelSession session = CreateModelSession(g_models[i], learnDevice);
-        auto binding = BindMLModel(session);
-        MLSessions.push_back(session);
-        MLBindings.push_back(binding);
+        g_models = FindModels();
+        try
+        {
+            return RunSelfTest(learnDevice);
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            LogReport(("FAIL: " + winrt::to_string(error.message()) + "\n").c_str());
+            return 1;
+        }
     }
 
     //------------- D3D11 and application initialization ------------
@@ -292,11 +940,21 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     winrt::com_ptr<ID3D11DeviceContext> d3d11Context{};
 
     // Create and show application window.
-    HWND hWnd = CreateAndShowWindow(hInstance, nCmdShow);
+    // Replays run headless so that window interaction cannot disturb them.
+    HWND hWnd = CreateAndShowWindow(hInstance, g_replay || g_synthetic ? SW_HIDE : nCmdShow);
 
     // Create D3D11 objects.
     InitializeGraphicsInfra(hWnd, learnDevice.Direct3D11Device(), swapChain, d3d11Device, d3d11Context);
 
+    // Models are loaded on first use. Start loading the initial style now so
+    // that it is ready by the time Babylon Native renders its first frame.
+    g_models = FindModels();
+    ModelManager models{g_models, learnDevice, CreateVideoFrame(g_BabylonRenderTexture.get()), CreateVideoFrame(g_StyledTexture.get()), g_maxResidentModels};
+    if (g_selectedModel >= 0 && static_cast<size_t>(g_selectedModel) < models.Count())
+    {
+        models.Prewarm(g_selectedModel);
+    }
+
     // --------------------- Babylon Native initialization --------------------------
 
     g_device = CreateBabylonGraphicsDevice(d3d11Device.get());
@@ -326,6 +984,11 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
         Babylon::Plugins::NativeEngine::Initialize(env);
         g_nativeInput = &Babylon::Plugins::NativeInput::CreateForJavaScript(env);
+
+        // Called by index.js after each `scene.render` with its draw calls.
+        env.Global().Set("setFrameDrawCalls", Napi::Function::New(env, [](const Napi::CallbackInfo& info) {
+            g_frameDrawCalls = info[0].As<Napi::Number>().Uint32Value();
+        }, "setFrameDrawCalls"));
     });
 
     // Load the scripts for Babylon.js core and loaders plus this app's index.js.
@@ -344,13 +1007,41 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
         addToContext.set_value();
 
         jsPromise.Get("then").As<Napi::Function>().Call(jsPromise, {Napi::Function::New(env, [&startup](const Napi::CallbackInfo& info) {
-            auto nativeTexture = info[0];
-            info.Env().Global().Get("startup").As<Napi::Function>().Call(
-                {
-                    nativeTexture,
-                    Napi::Value::From(info.Env(), WIDTH),
-                    Napi::Value::From(info.Env(), HEIGHT),
-                });
+            auto env = info.Env();
+            try
+            {
+                // Replays step the scene by a fixed time per frame so that
+                // they render the same frames however long each one takes.
+                auto sceneLoaded = env.Global().Get("startup").As<Napi::Function>().Call(
+                    {
+                        info[0],
+                        Napi::Value::From(env, WIDTH),
+                        Napi::Value::From(env, HEIGHT),
+                        Napi::String::From(env, g_sceneUrl),
+                        Napi::Boolean::New(env, g_optimizeScene),
+                        Napi::Boolean::New(env, g_replay.has_value()),
+                    });
+
+                // Recording and replay only cover frames once the scene has
+                // loaded so that network timing does not shift the input
+                // between frames.
+                sceneLoaded.As<Napi::Object>().Get("then").As<Napi::Function>().Call(sceneLoaded,
+                    {
+                        Napi::Function::New(env, [](const Napi::CallbackInfo&) {
+                            g_sceneLoaded = true;
+                        }),
+                        Napi::Function::New(env, [](const Napi::CallbackInfo& info) {
+                            OutputDebugStringA(("Failed to load the scene: " + info[0].ToString().Utf8Value() + "\n").c_str());
+                            g_sceneLoadFailed = true;
+                        }),
+                    });
+            }
+            catch (const Napi::Error& error)
+            {
+                OutputDebugStringA(("Failed to start: " + error.Message() + "\n").c_str());
+                g_sceneLoadFailed = true;
+            }
+
             startup.set_value();
         })});
     });
@@ -374,6 +1065,9 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     g_device->StartRenderingCurrentFrame();
     g_update->Start();
 
+    auto frameStart = std::chrono::steady_clock::now();
+    bool firstFrame = true;
+
     // Main message loop:
     while (msg.message != WM_QUIT)
     {
@@ -391,22 +1085,60 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                 g_update->Finish();
                 g_device->FinishRenderingCurrentFrame();
 
-                if (g_selectedModel >= 0)
+                const auto* model = g_selectedModel >= 0 && static_cast<size_t>(g_selectedModel) < models.Count() ? models.Get(g_selectedModel) : nullptr;
+                if (model != nullptr)
+                {
+                    // Run Style Transfer model from the Babylon Native render
+                    // target into the styled texture.
+                    RunModel(model->Session, model->Binding);
+                    CopyTexture(d3d11Context.get(), g_BackBufferTexture.get(), g_StyledTexture.get());
+                }
+                else
                 {
-                    // Copy Babylon Native renderer to WinML input frame.
-                    CopyTo(g_BabylonRenderTexture.get(), inputFrame, d3d11Context);
+                    // Without a style, or if it failed to load, present the
+                    // Babylon Native output as is.
+                    CopyTexture(d3d11Context.get(), g_BackBufferTexture.get(), g_BabylonRenderTexture.get());
+                }
 
-                    // Run Style Transfer model.
-                    VideoFrame result = RunModel(MLSessions[g_selectedModel], MLBindings[g_selectedModel], inputFrame);
+                // Present and start rendering next frame. Replays are not
+                // synchronized to the display so that they measure frame cost.
+                swapChain->Present(g_replay || g_synthetic ? 0 : 1, 0);
 
-                    // Copy result back to Babylon Native render target.
-                    CopyTo(result, g_BabylonRenderTexture.get(), d3d11Context);
+                if (firstFrame)
+                {
+                    LogMetrics("First frame", models.ResidentCount());
+                    firstFrame = false;
                 }
 
-                // Present and start rendering next frame.
-                swapChain->Present(1, 0);
+                auto frameEnd = std::chrono::steady_clock::now();
+                auto frameMicroseconds = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(frameEnd - frameStart).count());
+                frameStart = frameEnd;
+
+                // Deliver the input gathered since the last frame so the
+                // next `scene.render` sees it.
+                auto inputResult = g_nativeInput != nullptr ? ProcessFrameInput(frameMicroseconds, g_frameBytesCopied, g_frameDrawCalls, frameEnd) : FrameInputResult::Continue;
+                g_frameBytesCopied = 0;
+
                 g_device->StartRenderingCurrentFrame();
                 g_update->Start();
+
+                if (inputResult == FrameInputResult::ReplayFinished)
+                {
+                    if (g_synthetic)
+                    {
+                        g_exitCode = FinishSyntheticInput();
+                    }
+                    else
+                    {
+                        WriteReplayTimings();
+                    }
+                    DestroyWindow(hWnd);
+                }
+                else if (inputResult == FrameInputResult::ReplayFailed)
+                {
+                    g_exitCode = 1;
+                    DestroyWindow(hWnd);
+                }
             }
 
             result = PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE) && msg.message != WM_QUIT;
@@ -430,22 +1162,22 @@ void ProcessMouseButtons(tagPOINTER_BUTTON_CHANGE_TYPE changeType, int x, int y)
     switch (changeType)
     {
         case POINTER_CHANGE_FIRSTBUTTON_DOWN:
-            g_nativeInput->MouseDown(Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseDown, Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y);
             break;
         case POINTER_CHANGE_FIRSTBUTTON_UP:
-            g_nativeInput->MouseUp(Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseUp, Babylon::Plugins::NativeInput::LEFT_MOUSE_BUTTON_ID, x, y);
             break;
         case POINTER_CHANGE_SECONDBUTTON_DOWN:
-            g_nativeInput->MouseDown(Babylon::Plugins::NativeInput::RIGHT_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseDown, Babylon::Plugins::NativeInput::RIGHT_MOUSE_BUTTON_ID, x, y);
             break;
         case POINTER_CHANGE_SECONDBUTTON_UP:
-            g_nativeInput->MouseUp(Babylon::Plugins::NativeInput::RIGHT_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseUp, Babylon::Plugins::NativeInput::RIGHT_MOUSE_BUTTON_ID, x, y);
             break;
         case POINTER_CHANGE_THIRDBUTTON_DOWN:
-            g_nativeInput->MouseDown(Babylon::Plugins::NativeInput::MIDDLE_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseDown, Babylon::Plugins::NativeInput::MIDDLE_MOUSE_BUTTON_ID, x, y);
             break;
         case POINTER_CHANGE_THIRDBUTTON_UP:
-            g_nativeInput->MouseUp(Babylon::Plugins::NativeInput::MIDDLE_MOUSE_BUTTON_ID, x, y);
+            QueueInput(InputBuffer::EventType::MouseUp, Babylon::Plugins::NativeInput::MIDDLE_MOUSE_BUTTON_ID, x, y);
             break;
     }
 }
@@ -503,14 +1235,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         case WM_DESTROY:
         {
             Uninitialize();
-            PostQuitMessage(0);
+            PostQuitMessage(g_exitCode);
             break;
         }
         case WM_KEYDOWN:
         {
-            if (wParam == 'R')
+            if (wParam == 'R' && !g_replay)
             {
-                g_selectedModel = g_selectedModel < 3 ? (g_selectedModel + 1) : -1;
+                g_pendingModelChanges++;
             }
             break;
         }
@@ -518,7 +1250,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         {
             if (g_nativeInput != nullptr)
             {
-                g_nativeInput->MouseWheel(Babylon::Plugins::NativeInput::MOUSEWHEEL_Y_ID, -GET_WHEEL_DELTA_WPARAM(wParam));
+                QueueInput(InputBuffer::EventType::MouseWheel, Babylon::Plugins::NativeInput::MOUSEWHEEL_Y_ID, -GET_WHEEL_DELTA_WPARAM(wParam), 0);
             }
             break;
         }
@@ -540,7 +1272,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     }
                     else
                     {
-                        g_nativeInput->TouchDown(pointerId, x, y);
+                        QueueInput(InputBuffer::EventType::TouchDown, pointerId, x, y);
                     }
                 }
             }
@@ -561,11 +1293,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     if (info.pointerType == PT_MOUSE)
                     {
                         ProcessMouseButtons(info.ButtonChangeType, x, y);
-                        g_nativeInput->MouseMove(x, y);
+                        QueueInput(InputBuffer::EventType::MouseMove, 0, x, y);
                     }
                     else
                     {
-                        g_nativeInput->TouchMove(pointerId, x, y);
+                        QueueInput(InputBuffer::EventType::TouchMove, pointerId, x, y);
                     }
                 }
             }
@@ -589,7 +1321,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     }
                     else
                     {
-                        g_nativeInput->TouchUp(pointerId, x, y);
+                        QueueInput(InputBuffer::EventType::TouchUp, pointerId, x, y);
                     }
                 }
             }
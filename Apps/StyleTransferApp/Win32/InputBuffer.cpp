@@ -0,0 +1,155 @@
+#include "InputBuffer.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr uint64_t MOUSE_POINTER = ~uint64_t{0};
+
+    // Returns the pointer an event belongs to, or false for events (like the
+    // wheel) that do not affect pointer moves.
+    bool TryGetPointer(const InputBuffer::Event& event, uint64_t& pointer)
+    {
+        switch (event.Type)
+        {
+            case InputBuffer::EventType::MouseDown:
+            case InputBuffer::EventType::MouseUp:
+            case InputBuffer::EventType::MouseMove:
+                pointer = MOUSE_POINTER;
+                return true;
+            case InputBuffer::EventType::TouchDown:
+            case InputBuffer::EventType::TouchMove:
+            case InputBuffer::EventType::TouchUp:
+                pointer = event.Id;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool IsMove(const InputBuffer::Event& event)
+    {
+        return event.Type == InputBuffer::EventType::MouseMove || event.Type == InputBuffer::EventType::TouchMove;
+    }
+}
+
+bool InputBuffer::Push(const Event& event)
+{
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) % CAPACITY;
+    if (next == m_head.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    m_events[tail] = event;
+    m_pushTimes[tail] = Clock::now();
+    m_tail.store(next, std::memory_order_release);
+    return true;
+}
+
+const std::vector<InputBuffer::Event>& InputBuffer::Flush(Babylon::Plugins::NativeInput& nativeInput)
+{
+    m_pending.clear();
+
+    size_t head = m_head.load(std::memory_order_relaxed);
+    const size_t tail = m_tail.load(std::memory_order_acquire);
+    if (head != tail)
+    {
+        m_lastFlush.OldestPush = m_pushTimes[head];
+    }
+
+    while (head != tail)
+    {
+        m_pending.push_back(m_events[head]);
+        head = (head + 1) % CAPACITY;
+    }
+    m_head.store(head, std::memory_order_release);
+    m_lastFlush.Received = m_pending.size();
+
+    Coalesce();
+
+    for (const auto& event : m_delivered)
+    {
+        Send(nativeInput, event);
+    }
+
+    return m_delivered;
+}
+
+const InputBuffer::FlushStats& InputBuffer::LastFlush() const
+{
+    return m_lastFlush;
+}
+
+void InputBuffer::Send(Babylon::Plugins::NativeInput& nativeInput, const Event& event)
+{
+    switch (event.Type)
+    {
+        case EventType::MouseDown:
+            nativeInput.MouseDown(event.Id, event.X, event.Y);
+            break;
+        case EventType::MouseUp:
+            nativeInput.MouseUp(event.Id, event.X, event.Y);
+            break;
+        case EventType::MouseMove:
+            nativeInput.MouseMove(event.X, event.Y);
+            break;
+        case EventType::MouseWheel:
+            nativeInput.MouseWheel(event.Id, event.X);
+            break;
+        case EventType::TouchDown:
+            nativeInput.TouchDown(event.Id, event.X, event.Y);
+            break;
+        case EventType::TouchMove:
+            nativeInput.TouchMove(event.Id, event.X, event.Y);
+            break;
+        case EventType::TouchUp:
+            nativeInput.TouchUp(event.Id, event.X, event.Y);
+            break;
+    }
+}
+
+void InputBuffer::Coalesce()
+{
+    // Walk backwards remembering which pointers already have a later move. A
+    // move is redundant if its pointer moves again before any button or touch
+    // transition of that same pointer.
+    std::vector<uint64_t> movedLater{};
+    std::vector<bool> keep(m_pending.size(), true);
+
+    for (size_t i = m_pending.size(); i-- > 0;)
+    {
+        uint64_t pointer;
+        if (!TryGetPointer(m_pending[i], pointer))
+        {
+            continue;
+        }
+
+        auto it = std::find(movedLater.begin(), movedLater.end(), pointer);
+        if (IsMove(m_pending[i]))
+        {
+            if (it != movedLater.end())
+            {
+                keep[i] = false;
+            }
+            else
+            {
+                movedLater.push_back(pointer);
+            }
+        }
+        else if (it != movedLater.end())
+        {
+            movedLater.erase(it);
+        }
+    }
+
+    m_delivered.clear();
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        if (keep[i])
+        {
+            m_delivered.push_back(m_pending[i]);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Babylon/Plugins/NativeInput.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Collects pointer input from the window procedure and delivers it to
+// NativeInput once per frame instead of once per message. Consecutive moves
+// of the same pointer are coalesced into the last one so that high-rate
+// pointer devices do not flood the JavaScript thread.
+//
+// The buffer is a single-producer, single-consumer ring: `Push` must only be
+// called from one thread and `Flush` from one (possibly the same) thread.
+class InputBuffer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class EventType : uint8_t
+    {
+        MouseDown,
+        MouseUp,
+        MouseMove,
+        MouseWheel,
+        TouchDown,
+        TouchMove,
+        TouchUp,
+    };
+
+    struct Event
+    {
+        EventType Type;
+        uint32_t Id;  // Button id for mouse buttons, axis id for the wheel, pointer id for touches.
+        int32_t X;    // Wheel delta for the wheel.
+        int32_t Y;
+    };
+
+    // Queues an event. Returns false without queuing if the ring is full.
+    bool Push(const Event& event);
+
+    // Delivers all queued events to `nativeInput` with consecutive moves
+    // coalesced. Returns the events that were delivered, which stay valid
+    // until the next call.
+    const std::vector<Event>& Flush(Babylon::Plugins::NativeInput& nativeInput);
+
+    // The events that the last `Flush` took from the ring, before coalescing,
+    // and when the oldest of them was pushed.
+    struct FlushStats
+    {
+        size_t Received;
+        Clock::time_point OldestPush;
+    };
+
+    const FlushStats& LastFlush() const;
+
+    static void Send(Babylon::Plugins::NativeInput& nativeInput, const Event& event);
+
+private:
+    void Coalesce();
+
+    static constexpr size_t CAPACITY = 1024;
+
+    std::array<Event, CAPACITY> m_events{};
+    std::array<Clock::time_point, CAPACITY> m_pushTimes{};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+
+    // Only touched by the consumer.
+    std::vector<Event> m_pending{};
+    std::vector<Event> m_delivered{};
+    FlushStats m_lastFlush{};
+};
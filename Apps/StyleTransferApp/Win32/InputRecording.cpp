@@ -0,0 +1,106 @@
+#include "InputRecording.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// File layout (little-endian):
+//   char[4] magic "BNIR", uint32 version
+//   per frame: uint32 duration (us), int8 selected model, uint16 event count
+//   per event: uint8 type, uint32 id, int32 x, int32 y
+
+namespace
+{
+    constexpr char MAGIC[4] = {'B', 'N', 'I', 'R'};
+    constexpr uint32_t VERSION = 1;
+
+    template<typename T>
+    void Write(std::ostream& stream, T value)
+    {
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    T Read(std::istream& stream)
+    {
+        T value{};
+        stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+}
+
+InputRecording::Recorder::Recorder(const std::filesystem::path& filePath)
+    : m_stream{filePath, std::ios::binary | std::ios::trunc}
+{
+    if (!m_stream)
+    {
+        throw std::runtime_error{"Failed to create input recording " + filePath.string()};
+    }
+
+    m_stream.write(MAGIC, sizeof(MAGIC));
+    Write(m_stream, VERSION);
+}
+
+void InputRecording::Recorder::RecordFrame(uint32_t durationMicroseconds, int32_t selectedModel, const std::vector<InputBuffer::Event>& events)
+{
+    // Events beyond what fits in one frame record are extremely unlikely
+    // after coalescing, but spill them into empty follow-up frames rather
+    // than truncate the recording.
+    size_t offset = 0;
+    do
+    {
+        const auto count = static_cast<uint16_t>(std::min<size_t>(events.size() - offset, UINT16_MAX));
+
+        Write(m_stream, offset == 0 ? durationMicroseconds : 0);
+        Write(m_stream, static_cast<int8_t>(selectedModel));
+        Write(m_stream, count);
+
+        for (size_t i = offset; i < offset + count; i++)
+        {
+            Write(m_stream, static_cast<uint8_t>(events[i].Type));
+            Write(m_stream, events[i].Id);
+            Write(m_stream, events[i].X);
+            Write(m_stream, events[i].Y);
+        }
+
+        offset += count;
+    } while (offset < events.size());
+}
+
+std::vector<InputRecording::Frame> InputRecording::Load(const std::filesystem::path& filePath)
+{
+    std::ifstream stream{filePath, std::ios::binary};
+
+    char magic[sizeof(MAGIC)]{};
+    stream.read(magic, sizeof(magic));
+    if (!stream || !std::equal(std::begin(magic), std::end(magic), std::begin(MAGIC)) || Read<uint32_t>(stream) != VERSION)
+    {
+        throw std::runtime_error{"Not a supported input recording: " + filePath.string()};
+    }
+
+    std::vector<Frame> frames{};
+    while (stream.peek() != std::char_traits<char>::eof())
+    {
+        Frame frame{};
+        frame.DurationMicroseconds = Read<uint32_t>(stream);
+        frame.SelectedModel = Read<int8_t>(stream);
+
+        const auto count = Read<uint16_t>(stream);
+        frame.Events.resize(count);
+        for (auto& event : frame.Events)
+        {
+            event.Type = static_cast<InputBuffer::EventType>(Read<uint8_t>(stream));
+            event.Id = Read<uint32_t>(stream);
+            event.X = Read<int32_t>(stream);
+            event.Y = Read<int32_t>(stream);
+        }
+
+        if (!stream)
+        {
+            throw std::runtime_error{"Truncated input recording: " + filePath.string()};
+        }
+
+        frames.push_back(std::move(frame));
+    }
+
+    return frames;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "InputBuffer.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Records the input delivered at each frame boundary, along with the selected
+// style model, to a compact binary file so that an interactive session can be
+// replayed frame by frame for performance regression runs.
+namespace InputRecording
+{
+    struct Frame
+    {
+        uint32_t DurationMicroseconds; // Wall-clock time since the previous frame when recorded.
+        int32_t SelectedModel;
+        std::vector<InputBuffer::Event> Events;
+    };
+
+    class Recorder
+    {
+    public:
+        explicit Recorder(const std::filesystem::path& filePath);
+
+        void RecordFrame(uint32_t durationMicroseconds, int32_t selectedModel, const std::vector<InputBuffer::Event>& events);
+
+    private:
+        std::ofstream m_stream;
+    };
+
+    // Throws std::runtime_error if the file cannot be read or is not a
+    // recording of a supported version.
+    std::vector<Frame> Load(const std::filesystem::path& filePath);
+}
@@ -0,0 +1,150 @@
+#include "ModelManager.h"
+
+#include <winrt/Windows.Graphics.DirectX.Direct3D11.h>
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+using namespace winrt::Windows::AI::MachineLearning;
+using namespace winrt::Windows::Graphics::DirectX;
+using namespace winrt::Windows::Media;
+
+ModelManager::ModelManager(std::vector<winrt::hstring> modelPaths, LearningModelDevice device, VideoFrame inputFrame, VideoFrame outputFrame, size_t maxResidentModels)
+    : m_modelPaths{std::move(modelPaths)}
+    , m_device{std::move(device)}
+    , m_inputFrame{std::move(inputFrame)}
+    , m_outputFrame{std::move(outputFrame)}
+    , m_maxResidentModels{std::max<size_t>(maxResidentModels, 1)}
+    , m_failed(m_modelPaths.size(), false)
+{
+    auto description = m_outputFrame.Direct3DSurface().Description();
+    m_warmUpInput = VideoFrame::CreateAsDirect3D11SurfaceBacked(description.Format, description.Width, description.Height, m_device.Direct3D11Device());
+    m_warmUpOutput = VideoFrame::CreateAsDirect3D11SurfaceBacked(description.Format, description.Width, description.Height, m_device.Direct3D11Device());
+}
+
+size_t ModelManager::Count() const
+{
+    return m_modelPaths.size();
+}
+
+size_t ModelManager::ResidentCount() const
+{
+    return m_resident.size();
+}
+
+const ModelManager::Model* ModelManager::Get(size_t index)
+{
+    CollectPrewarmed(m_prewarm.valid() && m_prewarmIndex == index);
+
+    const Model* model = nullptr;
+    auto it = std::find_if(m_resident.begin(), m_resident.end(), [index](const Model& model) { return model.Index == index; });
+    if (it != m_resident.end())
+    {
+        m_resident.splice(m_resident.begin(), m_resident, it);
+        model = &m_resident.front();
+    }
+    else if (!m_failed[index])
+    {
+        try
+        {
+            Insert(Load(index, false));
+            model = &m_resident.front();
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            SetFailed(index, winrt::to_string(error.message()));
+        }
+        catch (const std::exception& exception)
+        {
+            SetFailed(index, exception.what());
+        }
+    }
+
+    // Only pre-warm when it will not evict the model in use.
+    if (m_maxResidentModels > 1)
+    {
+        Prewarm((index + 1) % m_modelPaths.size());
+    }
+
+    return model;
+}
+
+void ModelManager::Prewarm(size_t index)
+{
+    CollectPrewarmed(false);
+
+    const bool resident = std::any_of(m_resident.begin(), m_resident.end(), [index](const Model& model) { return model.Index == index; });
+    if (resident || m_failed[index] || m_prewarm.valid())
+    {
+        return;
+    }
+
+    m_prewarmIndex = index;
+    m_prewarm = std::async(std::launch::async, [this, index]() {
+        return Load(index, true);
+    });
+}
+
+ModelManager::Model ModelManager::Load(size_t index, bool warmUp) const
+{
+    auto model = LearningModel::LoadFromFilePath(m_modelPaths[index]);
+    LearningModelSession session{model, m_device};
+
+    // The first evaluation of a session compiles its operators, so do it
+    // here off the render loop.
+    if (warmUp)
+    {
+        LearningModelBinding warmUpBinding{session};
+        warmUpBinding.Bind(L"inputImage", m_warmUpInput);
+        warmUpBinding.Bind(L"outputImage", m_warmUpOutput);
+        session.Evaluate(warmUpBinding, L"WarmUp");
+    }
+
+    LearningModelBinding binding{session};
+    binding.Bind(L"inputImage", m_inputFrame);
+    binding.Bind(L"outputImage", m_outputFrame);
+
+    return {index, session, binding};
+}
+
+void ModelManager::CollectPrewarmed(bool wait)
+{
+    if (!m_prewarm.valid())
+    {
+        return;
+    }
+
+    if (wait || m_prewarm.wait_for(std::chrono::seconds{0}) == std::future_status::ready)
+    {
+        try
+        {
+            Insert(m_prewarm.get());
+        }
+        catch (const winrt::hresult_error& error)
+        {
+            SetFailed(m_prewarmIndex, winrt::to_string(error.message()));
+        }
+        catch (const std::exception& exception)
+        {
+            SetFailed(m_prewarmIndex, exception.what());
+        }
+    }
+}
+
+void ModelManager::Insert(Model model)
+{
+    m_resident.push_front(std::move(model));
+    while (m_resident.size() > m_maxResidentModels)
+    {
+        m_resident.pop_back();
+    }
+}
+
+void ModelManager::SetFailed(size_t index, const std::string& message)
+{
+    m_failed[index] = true;
+    OutputDebugStringA(("Failed to load style model " + winrt::to_string(m_modelPaths[index]) + ": " + message + "\n").c_str());
+}
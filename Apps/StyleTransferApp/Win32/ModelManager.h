@@ -0,0 +1,70 @@
+#pragma once
+
+#include <winrt/Windows.AI.MachineLearning.h>
+#include <winrt/Windows.Media.h>
+
+#include <future>
+#include <list>
+#include <string>
+#include <vector>
+
+// Loads style transfer models on first use and keeps the most recently used
+// ones resident. The model after the one in use is loaded and evaluated once
+// on a background thread so that cycling styles does not stall a frame, so the
+// device must be multithread protected. A model that fails to load is logged
+// and skipped from then on.
+class ModelManager
+{
+public:
+    struct Model
+    {
+        size_t Index;
+        winrt::Windows::AI::MachineLearning::LearningModelSession Session{nullptr};
+        winrt::Windows::AI::MachineLearning::LearningModelBinding Binding{nullptr};
+    };
+
+    // Every binding is bound once to `inputFrame` and `outputFrame`, so
+    // evaluating a model needs no per-frame binding and only one model may be
+    // evaluated at a time on the calling thread.
+    ModelManager(std::vector<winrt::hstring> modelPaths,
+        winrt::Windows::AI::MachineLearning::LearningModelDevice device,
+        winrt::Windows::Media::VideoFrame inputFrame,
+        winrt::Windows::Media::VideoFrame outputFrame,
+        size_t maxResidentModels);
+
+    size_t Count() const;
+    size_t ResidentCount() const;
+
+    // Returns the model, loading it now if it is neither resident nor being
+    // pre-warmed, and starts pre-warming the model after it. Returns null if
+    // the model failed to load.
+    const Model* Get(size_t index);
+
+    // Starts loading the model on a background thread if it is not resident.
+    void Prewarm(size_t index);
+
+private:
+    Model Load(size_t index, bool warmUp) const;
+    void CollectPrewarmed(bool wait);
+    void Insert(Model model);
+    void SetFailed(size_t index, const std::string& message);
+
+    const std::vector<winrt::hstring> m_modelPaths;
+    const winrt::Windows::AI::MachineLearning::LearningModelDevice m_device;
+    const winrt::Windows::Media::VideoFrame m_inputFrame;
+    const winrt::Windows::Media::VideoFrame m_outputFrame;
+    const size_t m_maxResidentModels;
+
+    // Most recently used first.
+    std::list<Model> m_resident{};
+
+    std::vector<bool> m_failed{};
+
+    size_t m_prewarmIndex{};
+    std::future<Model> m_prewarm{};
+
+    // Scratch frames for warm-up evaluations, which run concurrently with
+    // the render loop and so cannot use the shared frames.
+    winrt::Windows::Media::VideoFrame m_warmUpInput{nullptr};
+    winrt::Windows::Media::VideoFrame m_warmUpOutput{nullptr};
+};